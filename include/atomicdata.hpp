@@ -56,7 +56,7 @@ namespace atomicdata {
         return bytes;
     }
 
-    uint64_t unsignedFromVarintBytes(vector <const uint8_t>::iterator &itr) {
+    uint64_t unsignedFromVarintBytes(vector <uint8_t>::const_iterator &itr) {
         uint64_t number = 0;
         uint64_t multiplier = 1;
 
@@ -81,7 +81,7 @@ namespace atomicdata {
         return bytes;
     }
 
-    uint64_t unsignedFromIntBytes(vector <const uint8_t>::iterator &itr, uint64_t original_bytes = 8) {
+    uint64_t unsignedFromIntBytes(vector <uint8_t>::const_iterator &itr, uint64_t original_bytes = 8) {
         uint64_t number = 0;
         uint64_t multiplier = 1;
 
@@ -325,7 +325,7 @@ namespace atomicdata {
     }
 
 
-    ATOMIC_ATTRIBUTE deserialize_attribute(const string &type, vector <const uint8_t>::iterator &itr) {
+    ATOMIC_ATTRIBUTE deserialize_attribute(const string &type, vector <uint8_t>::const_iterator &itr) {
         if (type.find("[]", type.length() - 2) == type.length() - 2) {
             //Type is an array
             uint64_t array_length = unsignedFromVarintBytes(itr);
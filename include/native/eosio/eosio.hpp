@@ -0,0 +1,30 @@
+#pragma once
+
+// Stand-in for <eosio/eosio.hpp> when atomicdata.hpp and valuation.hpp are built as native code
+// for the tools. Only check() is used by those headers; here it throws instead of aborting the transaction.
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace eosio {
+
+    inline void check(bool pred, const char *msg) {
+        if (!pred) {
+            throw std::runtime_error(msg);
+        }
+    }
+
+    inline void check(bool pred, const std::string &msg) {
+        if (!pred) {
+            throw std::runtime_error(msg);
+        }
+    }
+}
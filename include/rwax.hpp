@@ -2,8 +2,10 @@
 #include <eosio/asset.hpp>
 #include <eosio/crypto.hpp>
 #include <eosio/singleton.hpp>
+#include <eosio/system.hpp>
 #include <eosio/transaction.hpp>
 #include "atomicdata.hpp"
+#include "valuation.hpp"
 #include "nlohmann/json.hpp"
 
 using namespace std;
@@ -15,6 +17,10 @@ static constexpr name CORE_TOKEN_CONTRACT = name("eosio.token");
 static constexpr name RWAX_TOKEN_CONTRACT = name("token.rwax");
 static constexpr symbol CORE_SYMBOL = symbol("WAX", 8);
 static constexpr symbol FEE_SYMBOL = symbol("RWAX", 8);
+static constexpr size_t MAX_DEPOSIT_CHUNK = 100;
+static constexpr uint32_t DEPOSIT_EXPIRY_SECONDS = 30 * 24 * 60 * 60;
+static constexpr uint32_t NO_TEMPLATE_CAP = 0xFFFFFFFF;
+static constexpr uint32_t LAYOUT_VERSION = 1; //tables converted by migrate
 
 struct TOKEN {
     name   token_contract;
@@ -26,6 +32,62 @@ struct TOKEN_BALANCE {
     asset  quantity;
 };
 
+//Fee shares owed by one payer, by recipient. Settled once per action with settle_fees
+typedef map<name, vector<TOKEN_BALANCE>> FEE_SHARES;
+
+enum class MEMO_TYPE : uint8_t {
+    NONE,
+    REDEEM,     //redeem or redeem:<asset_id>[,<asset_id>]
+    PAYFEE,
+    TOPUP,
+    BUY,
+    DEPOSIT,
+    TOKENIZE    //tokenize:<fee symbol>
+};
+
+struct MEMO {
+    MEMO_TYPE type;
+    vector<uint64_t> asset_ids;
+    symbol_code fee_currency;
+};
+
+struct POOL_PRICE {
+    uint64_t asset_id;
+    asset issued_tokens;
+};
+
+struct POOL_ENTRY {
+    uint64_t asset_id;
+    int64_t amount;         //issued tokens, in the token's precision
+};
+
+struct POOL_PAGE {
+    symbol token;
+    vector<POOL_ENTRY> entries;
+    bool more;              //false when this is the last page
+    uint64_t next_cursor;   //first asset_id of the next page, if more
+};
+
+struct REDEEM_ITEM {
+    symbol token;
+    uint64_t asset_id;
+};
+
+struct REDEEM_QUOTE {
+    vector<asset> amounts;          //per item, in request order
+    vector<asset> totals;           //per token, what redeem / redeemnfts must be called with
+    vector<TOKEN_BALANCE> fees;     //withdrawn from the fee balance
+};
+
+struct TOKEN_STATS {
+    uint32_t pooled_assets;
+    asset issued_tokens;    //sum over the pooled assets
+    asset min_value;
+    asset max_value;
+    asset avg_value;
+    bool migrated;          //false while migrate has not built the token's stats yet, the values are 0 then
+};
+
 struct POOL {
     name pool;
     symbol token;
@@ -52,6 +114,12 @@ struct TRAITFACTOR {
     vector<VALUEFACTOR> values;
 };
 
+struct TOKENIZE_RECORD {
+    uint64_t asset_id;
+    asset issued_tokens;
+    name contract;
+};
+
 CONTRACT rwax : public contract {
 public:
     using contract::contract;
@@ -80,6 +148,28 @@ public:
         uint64_t asset_id
     );
 
+    [[eosio::action, eosio::read_only]] REDEEM_QUOTE redeemquote(
+        vector<REDEEM_ITEM> items,
+        symbol fee_currency
+    );
+
+    [[eosio::action, eosio::read_only]] vector<POOL_PRICE> poolprices(
+        symbol token,
+        int64_t min_amount,
+        int64_t max_amount,
+        uint32_t limit
+    );
+
+    [[eosio::action, eosio::read_only]] POOL_PAGE poolpage(
+        symbol token,
+        uint64_t cursor,
+        uint32_t limit
+    );
+
+    [[eosio::action, eosio::read_only]] TOKEN_STATS tokenstats(
+        symbol token
+    );
+
     ACTION init();
 
     ACTION testcalc(
@@ -102,7 +192,9 @@ public:
         string token_name,
         string token_logo,
         string token_logo_lg,
-        symbol fee_currency
+        symbol fee_currency,
+        binary_extension<vector<string>> rarity_traits,
+        binary_extension<vector<TEMPLATE>> template_caps
     );
 
     ACTION setfactors(
@@ -110,7 +202,8 @@ public:
         name collection_name,
         asset maximum_supply,
         name contract,
-        vector<TRAITFACTOR> trait_factors
+        vector<TRAITFACTOR> trait_factors,
+        binary_extension<vector<string>> rarity_traits
     );
 
     ACTION setmaxassets(
@@ -118,15 +211,17 @@ public:
         name collection_name,
         asset maximum_supply,
         name contract,
-        uint32_t max_assets_to_tokenize
+        uint32_t max_assets_to_tokenize,
+        binary_extension<vector<TEMPLATE>> template_caps
     );
 
-    ACTION tokenizenfts(
+    [[eosio::action]] vector<TOKENIZE_RECORD> tokenizenfts(
         name user,
         vector<uint64_t> asset_ids,
         symbol fee_currency
     );
 
+    //No longer sent, kept so earlier traces still decode. See logtokenizes
     ACTION logtokenize(
         uint64_t asset_id,
         name tokenizer,
@@ -134,6 +229,48 @@ public:
         name contract
     );
 
+    ACTION logtokenizes(
+        name tokenizer,
+        vector<TOKENIZE_RECORD> records
+    );
+
+    [[eosio::action]] vector<TOKENIZE_RECORD> tokenizeall(
+        name user,
+        symbol fee_currency,
+        uint32_t max_assets
+    );
+
+    ACTION sweep(
+        name user,
+        uint32_t max_rows
+    );
+
+    ACTION createjob(
+        name user,
+        vector<uint64_t> asset_ids,
+        symbol fee_currency
+    );
+
+    [[eosio::action]] vector<TOKENIZE_RECORD> crank(
+        name keeper,
+        uint64_t job_id,
+        uint32_t max_assets
+    );
+
+    ACTION canceljob(
+        name user,
+        uint64_t job_id
+    );
+
+    ACTION logcrank(
+        uint64_t job_id,
+        name user,
+        uint32_t cursor,
+        uint32_t total,
+        vector<uint64_t> skipped_ids,
+        vector<string> errors
+    );
+
     ACTION settokenfee(
         asset fees
     );
@@ -162,6 +299,29 @@ public:
         symbol fee_currency
     );
 
+    ACTION redeemnfts(
+        name redeemer,
+        name contract,
+        asset quantity,
+        vector<uint64_t> asset_ids,
+        symbol fee_currency
+    );
+
+    ACTION redeemany(
+        name redeemer,
+        name contract,
+        asset max_price,
+        symbol fee_currency
+    );
+
+    [[eosio::action]] uint64_t migrate(
+        name table,
+        uint64_t scope,
+        uint32_t max_rows
+    );
+
+    ACTION endmigrate();
+
     ACTION buyrwax(
         asset amount,
         name buyer
@@ -186,9 +346,51 @@ public:
         name contract
     );
 private:
-    asset calculate_issued_tokens(
-        name account,
-        uint64_t asset_id
+    uint64_t get_trait_key(
+        string trait_name,
+        string value
+    );
+
+    uint64_t get_trait_total_key(
+        string trait_name
+    );
+
+    float get_rarity_factor(
+        symbol token,
+        TRAITFACTOR trait_factor,
+        string value
+    );
+
+    void set_template_caps(
+        name collection_name,
+        name schema_name,
+        symbol token,
+        name ram_payer,
+        vector<TEMPLATE> template_caps
+    );
+
+    vector<uint64_t> add_trait_counts(
+        symbol token,
+        name ram_payer,
+        vector<pair<string, string>> rarity_values
+    );
+
+    void remove_trait_counts(
+        symbol token,
+        vector<uint64_t> trait_keys
+    );
+
+    void redeem_assets(
+        name redeemer,
+        name contract,
+        asset quantity,
+        vector<uint64_t> asset_ids,
+        symbol fee_currency,
+        bool from_balance
+    );
+
+    MEMO parse_memo(
+        const string& memo
     );
 
     void withdraw_balances(
@@ -196,6 +398,28 @@ private:
         vector<TOKEN_BALANCE> tokens
     );
 
+    void add_fee_shares(
+        FEE_SHARES& fee_shares,
+        asset fees,
+        symbol fee_currency,
+        name collection_account
+    );
+
+    void add_fee_share(
+        FEE_SHARES& fee_shares,
+        name recipient,
+        TOKEN_BALANCE share
+    );
+
+    vector<TOKEN_BALANCE> get_fee_totals(
+        FEE_SHARES fee_shares
+    );
+
+    void settle_fees(
+        name payer,
+        FEE_SHARES fee_shares
+    );
+
     void add_balances(
         name account,
         vector<TOKEN_BALANCE> tokens
@@ -212,21 +436,66 @@ private:
         name authorized_account
     );
 
+    bool is_migrated();
+
+    void check_pools_indexed(
+        symbol token
+    );
+
+    void check_rarity_traits(
+        name collection_name,
+        name schema_name,
+        const vector<string>& rarity_traits,
+        const vector<TRAITFACTOR>& trait_factors
+    );
+
     bool is_token_supported(
         name token_contract,
         symbol token_symbol
     );
     
-    void tokenize_asset(
+    vector<bool> take_deposits(
+        name user,
+        const vector<uint64_t>& asset_ids,
+        vector<time_point_sec>* deposited = nullptr
+    );
+
+    vector<uint64_t> take_first_deposits(
+        name user,
+        uint32_t max_assets,
+        vector<time_point_sec>& deposited
+    );
+
+    void add_deposit(
+        name user,
+        vector<uint64_t> asset_ids,
+        time_point_sec deposited
+    );
+
+    vector<uint64_t> remove_deposited(
+        vector<uint64_t> deposited_assets,
+        const vector<uint64_t>& asset_ids,
+        vector<bool>& found
+    );
+
+    TOKENIZE_RECORD tokenize_asset(
         uint64_t asset_id,
         name receiver,
-        symbol fee_currency
+        symbol fee_currency,
+        name ram_payer,
+        FEE_SHARES& fee_shares,
+        string* error = nullptr
     );
 
     name find_asset_pool(
         asset token
     );
 
+    void log_tokenizes(
+        name tokenizer,
+        vector<TOKENIZE_RECORD> records
+    );
+
     float get_maximum_factor(
         vector<TRAITFACTOR> trait_factors
     );
@@ -236,6 +505,7 @@ private:
         vector<name> stake_pools                     = {};
         asset redeem_fees;
         asset tokenize_fees;
+        binary_extension<uint32_t> layout_version; //set to LAYOUT_VERSION by endmigrate
     };
 
     typedef singleton <name("config"), config_s>           config_t;
@@ -339,10 +609,83 @@ private:
     TABLE traitfactors_s {
         symbol token;
         vector<TRAITFACTOR> trait_factors;
+        binary_extension<vector<string>> rarity_traits;
 
         uint64_t primary_key() const { return (uint64_t) token.code().raw(); } 
     };
 
+    // Number of pooled assets per (trait, value) of the rarity traits, scoped by token symbol.
+    // Rows keyed by get_trait_total_key hold the number of pooled assets that have the trait at all.
+    TABLE traitcounts_s {
+        uint64_t id;
+        string trait_name;
+        string value;
+        uint32_t count;
+
+        uint64_t primary_key() const { return id; }
+    };
+
+    // Tokenized assets per template, scoped by token symbol. Templates without a cap get a row
+    // with NO_TEMPLATE_CAP on their first tokenization, so a cap set later starts from the right count.
+    TABLE templatecaps_s {
+        int32_t template_id;
+        uint32_t max_assets_to_tokenize;
+        uint32_t currently_tokenized;
+
+        uint64_t primary_key() const { return (uint64_t) template_id; }
+    };
+
+    // Every token by symbol code, whatever contract issues it. Symbols are unique across contracts,
+    // as assetpools, traitcounts and templatecaps are already scoped by symbol alone.
+    TABLE symbols_s {
+        symbol token;
+        name contract;
+        name collection_name;
+        name schema_name;
+
+        uint64_t primary_key() const { return (uint64_t) token.code().raw(); }
+        uint64_t by_collection() const { return collection_name.value; }
+        uint64_t by_contract() const { return contract.value; }
+    };
+
+    // Progress of migrate in one scope of a table, scoped by table name. Erased when the scope is done.
+    TABLE migrations_s {
+        uint64_t scope;
+        uint64_t cursor;            //first key not converted yet
+        bool build_stats;           //assetpools without a poolstats row: the pools are counted
+        uint32_t pooled_assets;
+        int64_t issued_amount;
+
+        uint64_t primary_key() const { return scope; }
+    };
+
+    // Aggregates of the pooled assets of each token, updated on every tokenize and redeem.
+    // Tokens created before the table have no row until migrate builds it.
+    TABLE poolstats_s {
+        uint32_t pooled_assets;
+        asset issued_tokens;
+        asset min_value;
+        asset max_value;
+
+        uint64_t primary_key() const { return (uint64_t) issued_tokens.symbol.code().raw(); }
+    };
+
+    // Everything tokenize, redeem and the valuation need of a tokenized schema, scoped by collection.
+    // Once a schema has a descriptor, its counters are kept here only: issued_supply in tokens and
+    // currently_tokenized in schemamap stop at the values migrate copied.
+    TABLE descriptors_s {
+        name schema_name;
+        asset maximum_supply;
+        asset issued_supply;
+        name contract;
+        name authorized_account;
+        uint32_t max_assets_to_tokenize; //the schema's, cap of currently_tokenized
+        uint32_t currently_tokenized;
+        uint32_t issue_divisor; //the token's max_assets_to_tokenize, divides maximum_supply among the assets
+
+        uint64_t primary_key() const { return schema_name.value; }
+    };
+
     TABLE schemamap_s {
         name schema_name;
         uint32_t max_assets_to_tokenize;
@@ -353,18 +696,50 @@ private:
         uint64_t primary_key() const { return schema_name.value; }
     };
 
+    //Legacy pending transfers, one row per user. New deposits go to deposits_s
     TABLE transfers_s {
         name user;
-        vector<uint64_t> assets;
+        vector<uint64_t> assets; //sorted ascending
 
         auto primary_key() const { return user.value; };
     };
 
+    //Pending deposits in chunks of at most MAX_DEPOSIT_CHUNK assets, so a deposit only writes its own rows
+    TABLE deposits_s {
+        uint64_t id;
+        name user;
+        vector<uint64_t> assets; //sorted ascending
+        time_point_sec deposited;
+
+        uint64_t primary_key() const { return id; }
+        uint64_t by_user() const { return user.value; }
+        uint64_t by_time() const { return deposited.sec_since_epoch(); }
+        uint128_t by_user_time() const { return ((uint128_t) user.value << 64) | deposited.sec_since_epoch(); }
+    };
+
+    //Tokenization of more assets than fit in one transaction, processed by crank from cursor on
+    TABLE jobs_s {
+        uint64_t id;
+        name user;
+        symbol fee_currency;
+        vector<uint64_t> asset_ids;
+        uint32_t cursor;
+        time_point_sec deposited; //oldest deposit of the assets, kept when they go back
+
+        uint64_t primary_key() const { return id; }
+        uint64_t by_user() const { return user.value; }
+    };
+
     TABLE assetpools_s {
         uint64_t asset_id;
         asset issued_tokens;
+        binary_extension<vector<uint64_t>> trait_keys;
+        binary_extension<int32_t> template_id; //set if counted in templatecaps
+        binary_extension<name> collection_name;
+        binary_extension<name> schema_name;
 
         uint64_t primary_key() const { return (uint64_t) asset_id; } 
+        uint64_t by_issued() const { return (uint64_t) issued_tokens.amount; }
     };
     
     typedef eosio::multi_index<name("collections"), collections_s> collections_t;
@@ -374,21 +749,40 @@ private:
     typedef eosio::multi_index<name("tokens"), tokens_s> tokens_t;
     typedef eosio::multi_index<name("feetokens"), feetokens_s> feetokens_t;
     typedef eosio::multi_index<name("schemamap"), schemamap_s> schemamap_t;
-    typedef eosio::multi_index<name("assetpools"), assetpools_s> assetpools_t;
+    typedef eosio::multi_index<name("descriptors"), descriptors_s> descriptors_t;
+    typedef eosio::multi_index<name("assetpools"), assetpools_s,
+        indexed_by<name("issued"), const_mem_fun<assetpools_s, uint64_t, &assetpools_s::by_issued>>> assetpools_t;
     typedef eosio::multi_index<name("transfers"), transfers_s> transfers_t;
+    typedef eosio::multi_index<name("deposits"), deposits_s,
+        indexed_by<name("user"), const_mem_fun<deposits_s, uint64_t, &deposits_s::by_user>>,
+        indexed_by<name("time"), const_mem_fun<deposits_s, uint64_t, &deposits_s::by_time>>,
+        indexed_by<name("usertime"), const_mem_fun<deposits_s, uint128_t, &deposits_s::by_user_time>>> deposits_t;
+    typedef eosio::multi_index<name("jobs"), jobs_s,
+        indexed_by<name("user"), const_mem_fun<jobs_s, uint64_t, &jobs_s::by_user>>> jobs_t;
     typedef eosio::multi_index<name("balances"), balances_s> balances_t;
     typedef eosio::multi_index<name("rewards"), rewards_s> rewards_t;
     typedef eosio::multi_index<name("traitfactors"), traitfactors_s> traitfactors_t;
+    typedef eosio::multi_index<name("traitcounts"), traitcounts_s> traitcounts_t;
+    typedef eosio::multi_index<name("templatecaps"), templatecaps_s> templatecaps_t;
+    typedef eosio::multi_index<name("poolstats"), poolstats_s> poolstats_t;
+    typedef eosio::multi_index<name("migrations"), migrations_s> migrations_t;
+    typedef eosio::multi_index<name("symbols"), symbols_s,
+        indexed_by<name("collection"), const_mem_fun<symbols_s, uint64_t, &symbols_s::by_collection>>,
+        indexed_by<name("contract"), const_mem_fun<symbols_s, uint64_t, &symbols_s::by_contract>>> symbols_t;
     typedef eosio::multi_index <name("schemas"), schemas_s> schemas_t;
     
     collections_t collections = collections_t(name("atomicassets"), name("atomicassets").value);
     pools_t pools = pools_t(name("swap.alcor"), name("swap.alcor").value);
     
     transfers_t transfers = transfers_t(get_self(), get_self().value);
+    deposits_t deposits = deposits_t(get_self(), get_self().value);
+    jobs_t jobs = jobs_t(get_self(), get_self().value);
     feetokens_t feetokens = feetokens_t(get_self(), get_self().value);
     balances_t balances = balances_t(get_self(), get_self().value);
     config_t config = config_t(get_self(), get_self().value);
     tokensale_t tokensale = tokensale_t(get_self(), get_self().value);
+    poolstats_t poolstats = poolstats_t(get_self(), get_self().value);
+    symbols_t symbols = symbols_t(get_self(), get_self().value);
 
     tokens_t get_tokens(name contract) {
         return tokens_t(get_self(), contract.value);
@@ -398,6 +792,14 @@ private:
         return schemamap_t(get_self(), collection.value);
     }
 
+    descriptors_t get_descriptors(name collection) {
+        return descriptors_t(get_self(), collection.value);
+    }
+
+    migrations_t get_migrations(name table) {
+        return migrations_t(get_self(), table.value);
+    }
+
     traitfactors_t get_traitfactors(name contract) {
         return traitfactors_t(get_self(), contract.value);
     }
@@ -414,7 +816,78 @@ private:
         return assetpools_t(get_self(), symbolraw);
     }
 
+    traitcounts_t get_traitcounts(uint64_t symbolraw) {
+        return traitcounts_t(get_self(), symbolraw);
+    }
+
+    templatecaps_t get_templatecaps(uint64_t symbolraw) {
+        return templatecaps_t(get_self(), symbolraw);
+    }
+
     schemas_t get_schemas(name collection_name) {
         return schemas_t(name("atomicassets"), collection_name.value);
     }
+
+    asset calculate_issued_tokens(
+        name account,
+        uint64_t asset_id,
+        vector<pair<string, string>>* rarity_values = nullptr,
+        const descriptors_s* descriptor = nullptr
+    );
+
+    bool get_descriptor(
+        name collection_name,
+        name schema_name,
+        descriptors_s& descriptor
+    );
+
+    bool get_descriptor(
+        descriptors_t& descriptors,
+        name collection_name,
+        name schema_name,
+        descriptors_t::const_iterator& descriptor_itr,
+        descriptors_s& descriptor
+    );
+
+    void add_tokenized(
+        descriptors_t& descriptors,
+        descriptors_t::const_iterator descriptor_itr,
+        name collection_name,
+        name schema_name,
+        int32_t count,
+        asset issued_tokens
+    );
+
+    pair<name, name> get_pool_schema(
+        const assetpools_s& pool
+    );
+
+    bool migrate_tokens(
+        name contract,
+        migrations_s& migration,
+        uint32_t max_rows
+    );
+
+    bool migrate_pools(
+        symbol token,
+        migrations_s& migration,
+        uint32_t max_rows
+    );
+
+    bool migrate_transfers(
+        migrations_s& migration,
+        uint32_t max_rows
+    );
+
+    void count_migrating_pool(
+        symbol token,
+        uint64_t asset_id,
+        int32_t count,
+        int64_t amount
+    );
+
+    name get_token_contract(
+        const assetpools_s& pool,
+        symbol token
+    );
 };
@@ -0,0 +1,202 @@
+#pragma once
+
+#include "atomicdata.hpp"
+
+#ifdef RWAX_GENERATED_SCHEMAS
+#include RWAX_GENERATED_SCHEMAS
+#endif
+
+using namespace atomicdata;
+
+// Valuation of a single asset from its trait factors. Shared by the contract (calculate_issued_tokens)
+// and the native tools, so anything changed here changes how many tokens an asset is worth on chain.
+namespace valuation {
+
+    // Traits of an asset looked up in the template, immutable and mutable data.
+    // Mutable data overrides immutable data, which overrides template data.
+    struct ASSET_ATTRIBUTES {
+        const vector <FORMAT> &format_lines;
+        const ATTRIBUTE_MAP &template_data;
+        const ATTRIBUTE_MAP &immutable_data;
+        const ATTRIBUTE_MAP &mutable_data;
+
+        const ATOMIC_ATTRIBUTE *find(const string &trait_name) const {
+            auto itr = mutable_data.find(trait_name);
+            if (itr != mutable_data.end()) {
+                return &itr->second;
+            }
+            itr = immutable_data.find(trait_name);
+            if (itr != immutable_data.end()) {
+                return &itr->second;
+            }
+            itr = template_data.find(trait_name);
+            if (itr != template_data.end()) {
+                return &itr->second;
+            }
+            return nullptr;
+        }
+
+        bool has(const string &trait_name) const {
+            return find(trait_name) != nullptr;
+        }
+
+        string get_string(const string &trait_name) const {
+            return std::get <string>(*find(trait_name));
+        }
+
+        //Types that are not listed here count as 0
+        double get_number(const string &trait_name) const {
+            const ATOMIC_ATTRIBUTE &trait = *find(trait_name);
+            double value = 0;
+            for (const FORMAT &format : format_lines) {
+                if (format.name == trait_name) {
+                    if (format.type == "int8") {
+                        value = std::get <int8_t>(trait);
+                    } else if (format.type == "int16") {
+                        value = std::get <int16_t>(trait);
+                    } else if (format.type == "int32") {
+                        value = std::get <int32_t>(trait);
+                    } else if (format.type == "int64") {
+                        value = std::get <int64_t>(trait);
+                    } else if (format.type == "uint8") {
+                        value = std::get <uint8_t>(trait);
+                    } else if (format.type == "uint16") {
+                        value = std::get <uint16_t>(trait);
+                    } else if (format.type == "uint32") {
+                        value = std::get <uint32_t>(trait);
+                    } else if (format.type == "uint64") {
+                        value = std::get <uint64_t>(trait);
+                    } else if (format.type == "float") {
+                        value = std::get <float>(trait);
+                    } else if (format.type == "double") {
+                        value = std::get <double>(trait);
+                    }
+                }
+            }
+            return value;
+        }
+    };
+
+    //The factor of the last matching value is used, 1 if no value matches
+    template <typename FACTOR>
+    float get_value_factor(const FACTOR &trait_factor, const string &trait_value) {
+        float factor = 1;
+        for (const auto &value : trait_factor.values) {
+            if (value.value == trait_value) {
+                factor = value.factor;
+            }
+        }
+        return factor;
+    }
+
+    //The value is clamped to [min_value, max_value] and mapped linearly onto [min_factor, max_factor]
+    template <typename FACTOR>
+    float get_numeric_factor(const FACTOR &trait_factor, double value) {
+        if (trait_factor.max_value < trait_factor.min_value) {
+            value = std::max(value, double(trait_factor.max_value));
+            value = std::min(value, double(trait_factor.min_value));
+        } else {
+            value = std::min(value, double(trait_factor.max_value));
+            value = std::max(value, double(trait_factor.min_value));
+        }
+
+        return ((trait_factor.max_factor - trait_factor.min_factor) / (trait_factor.max_value - trait_factor.min_value))
+            * (value - trait_factor.min_value) + trait_factor.min_factor;
+    }
+
+    //value_count and total_count must not include the asset being valued
+    inline float get_rarity_factor(float min_factor, float max_factor, uint32_t value_count, uint32_t total_count) {
+        float share = float(value_count + 1) / float(total_count + 1);
+
+        return max_factor - (max_factor - min_factor) * share;
+    }
+
+    //Factor of a single trait, 1 if the asset does not have the trait
+    template <typename FACTOR, typename ATTRIBUTES, typename RARITY_FACTOR>
+    float get_trait_factor(
+        const FACTOR &trait_factor,
+        bool is_rarity_trait,
+        const ATTRIBUTES &attributes,
+        RARITY_FACTOR &&get_rarity
+    ) {
+        if (!attributes.has(trait_factor.trait_name)) {
+            return 1;
+        }
+        if (is_rarity_trait) {
+            return get_rarity(trait_factor, attributes.get_string(trait_factor.trait_name));
+        }
+        if (trait_factor.values.size() > 0) {
+            return get_value_factor(trait_factor, attributes.get_string(trait_factor.trait_name));
+        }
+        return get_numeric_factor(trait_factor, attributes.get_number(trait_factor.trait_name));
+    }
+
+    // Product of the trait factors divided by the product of their average factors. Factors have to be
+    // added in the order of the trait factors, float multiplication is not associative.
+    struct FACTOR_PRODUCT {
+        float total_factor = 1.0;
+        float total_avg_factor = 1.0;
+
+        void add(float factor, float avg_factor) {
+            if (factor > 0) {
+                total_factor *= factor;
+                total_avg_factor *= avg_factor;
+            }
+        }
+
+        float ratio() const {
+            return total_factor / total_avg_factor;
+        }
+    };
+
+    //get_rarity(trait_factor, trait_value) is called for traits listed in rarity_traits
+    template <typename FACTOR, typename ATTRIBUTES, typename RARITY_FACTOR>
+    float get_factor_ratio(
+        const vector <FACTOR> &trait_factors,
+        const vector <string> &rarity_traits,
+        const ATTRIBUTES &attributes,
+        RARITY_FACTOR &&get_rarity
+    ) {
+        FACTOR_PRODUCT product = {};
+
+        for (const FACTOR &trait_factor : trait_factors) {
+            bool is_rarity_trait = std::find(rarity_traits.begin(), rarity_traits.end(), trait_factor.trait_name) != rarity_traits.end();
+
+            product.add(get_trait_factor(trait_factor, is_rarity_trait, attributes, get_rarity), trait_factor.avg_factor);
+        }
+
+        return product.ratio();
+    }
+
+    // Decodes the asset with a decoder generated by rwax-schemagen and calls body(attributes), if the build
+    // was made with -DRWAX_GENERATED_SCHEMAS="<header>" and the header has one for the schema. Returns false otherwise.
+    template <typename BODY>
+    bool with_generated_attributes(
+        [[maybe_unused]] uint64_t collection_name,
+        [[maybe_unused]] uint64_t schema_name,
+        [[maybe_unused]] size_t format_size,
+        [[maybe_unused]] const vector <uint8_t> *template_data,
+        [[maybe_unused]] const vector <uint8_t> &immutable_data,
+        [[maybe_unused]] const vector <uint8_t> &mutable_data,
+        [[maybe_unused]] BODY &&body
+    ) {
+#ifdef RWAX_GENERATED_SCHEMAS
+        return generated_schemas::with_attributes(
+            collection_name,
+            schema_name,
+            format_size,
+            template_data,
+            immutable_data,
+            mutable_data,
+            body
+        );
+#else
+        return false;
+#endif
+    }
+
+    //Truncates like the asset constructor in calculate_issued_tokens
+    inline int64_t get_issued_amount(int64_t maximum_supply, uint32_t max_assets_to_tokenize, float factor_ratio) {
+        return (maximum_supply / max_assets_to_tokenize) * factor_ratio;
+    }
+}
@@ -13,7 +13,9 @@ ACTION rwax::createtoken(
     string token_name,
     string token_logo,
     string token_logo_lg,
-    symbol fee_currency
+    symbol fee_currency,
+    binary_extension<vector<string>> rarity_traits,
+    binary_extension<vector<TEMPLATE>> template_caps
 ) {
     check_collection_auth(collection_name, authorized_account);
 
@@ -42,6 +44,7 @@ ACTION rwax::createtoken(
     tokens_t tokens = get_tokens(contract);
     auto token_itr = tokens.find(maximum_supply.symbol.code().raw());
     check(token_itr == tokens.end(), "Symbol already exists");
+    check(symbols.find(maximum_supply.symbol.code().raw()) == symbols.end(), "Symbol already exists");
 
     asset trait_factor_token_share = asset(0, maximum_supply.symbol);
 
@@ -62,11 +65,16 @@ ACTION rwax::createtoken(
 
     check(trait_factor_token_share.amount <= maximum_supply.amount, "Trait Factor Token Share exceeds Total Supply");
 
+    vector<string> rarity_trait_names = rarity_traits.has_value() ? rarity_traits.value() : vector<string>{};
+
+    check_rarity_traits(collection_name, schema_name, rarity_trait_names, trait_factors);
+
     if (trait_factors.size() > 0) {
         traitfactors_t traitfactors = get_traitfactors(contract);
         traitfactors.emplace(authorized_account, [&](auto& new_factor) {
             new_factor.token = maximum_supply.symbol;
             new_factor.trait_factors = trait_factors;
+            new_factor.rarity_traits.emplace(rarity_trait_names);
         });
     }
 
@@ -80,6 +88,20 @@ ACTION rwax::createtoken(
         new_token.max_assets_to_tokenize = max_assets_to_tokenize;
     });
 
+    symbols.emplace(authorized_account, [&](auto& new_symbol) {
+        new_symbol.token = maximum_supply.symbol;
+        new_symbol.contract = contract;
+        new_symbol.collection_name = collection_name;
+        new_symbol.schema_name = schema_name;
+    });
+
+    poolstats.emplace(authorized_account, [&](auto& new_stats) {
+        new_stats.pooled_assets = 0;
+        new_stats.issued_tokens = asset(0, maximum_supply.symbol);
+        new_stats.min_value = asset(0, maximum_supply.symbol);
+        new_stats.max_value = asset(0, maximum_supply.symbol);
+    });
+
     schemamap_t schemamap = get_schemamap(collection_name);
 
     auto schemamap_itr = schemamap.find(schema_name.value);
@@ -94,6 +116,23 @@ ACTION rwax::createtoken(
         new_schema.contract = contract;
     });
 
+    descriptors_t descriptors = get_descriptors(collection_name);
+
+    descriptors.emplace(authorized_account, [&](auto& new_descriptor) {
+        new_descriptor.schema_name = schema_name;
+        new_descriptor.maximum_supply = maximum_supply;
+        new_descriptor.issued_supply = asset(0, maximum_supply.symbol);
+        new_descriptor.contract = contract;
+        new_descriptor.authorized_account = authorized_account;
+        new_descriptor.max_assets_to_tokenize = max_assets_to_tokenize;
+        new_descriptor.currently_tokenized = 0;
+        new_descriptor.issue_divisor = max_assets_to_tokenize;
+    });
+
+    if (template_caps.has_value()) {
+        set_template_caps(collection_name, schema_name, maximum_supply.symbol, authorized_account, template_caps.value());
+    }
+
     if (contract == RWAX_TOKEN_CONTRACT) {
         action(
             permission_level{get_self(), name("active")},
@@ -162,7 +201,8 @@ ACTION rwax::setmaxassets(
     name collection_name,
     asset maximum_supply,
     name contract,
-    uint32_t max_assets_to_tokenize
+    uint32_t max_assets_to_tokenize,
+    binary_extension<vector<TEMPLATE>> template_caps
 ) {
     check_collection_auth(collection_name, authorized_account);
 
@@ -185,11 +225,29 @@ ACTION rwax::setmaxassets(
         new_token.max_assets_to_tokenize = max_assets_to_tokenize;
     });
 
-    check(schemamap_itr->currently_tokenized <= max_assets_to_tokenize, "Already more assets tokenized");
+    descriptors_t descriptors = get_descriptors(collection_name);
+
+    auto descriptor_itr = descriptors.find(token_itr->schema_name.value);
+
+    // Once migrated, only the descriptor counts tokenized assets
+    if (descriptor_itr != descriptors.end()) {
+        check(descriptor_itr->currently_tokenized <= max_assets_to_tokenize, "Already more assets tokenized");
+
+        descriptors.modify(descriptor_itr, authorized_account, [&](auto& new_descriptor) {
+            new_descriptor.max_assets_to_tokenize = max_assets_to_tokenize;
+            new_descriptor.issue_divisor = max_assets_to_tokenize;
+        });
+    } else {
+        check(schemamap_itr->currently_tokenized <= max_assets_to_tokenize, "Already more assets tokenized");
+    }
 
     schemamap.modify(schemamap_itr, authorized_account, [&](auto& new_schema) {
         new_schema.max_assets_to_tokenize = max_assets_to_tokenize;
     });
+
+    if (template_caps.has_value()) {
+        set_template_caps(collection_name, token_itr->schema_name, maximum_supply.symbol, authorized_account, template_caps.value());
+    }
 }
 
 ACTION rwax::setfactors(
@@ -197,7 +255,8 @@ ACTION rwax::setfactors(
     name collection_name,
     asset maximum_supply,
     name contract,
-    vector<TRAITFACTOR> trait_factors
+    vector<TRAITFACTOR> trait_factors,
+    binary_extension<vector<string>> rarity_traits
 ) {
     check_collection_auth(collection_name, authorized_account);
     
@@ -234,14 +293,36 @@ ACTION rwax::setfactors(
     if (trait_factors.size() > 0) {
         traitfactors_t traitfactors = get_traitfactors(contract);
         auto traitfactors_itr = traitfactors.find(maximum_supply.symbol.code().raw());
+
+        vector<string> current_rarity_traits = traitfactors_itr != traitfactors.end() && traitfactors_itr->rarity_traits.has_value()
+            ? traitfactors_itr->rarity_traits.value() : vector<string>{};
+
+        // Without rarity_traits, the ones already set are kept
+        vector<string> rarity_trait_names = rarity_traits.has_value() ? rarity_traits.value() : current_rarity_traits;
+
+        check_rarity_traits(collection_name, token_itr->schema_name, rarity_trait_names, trait_factors);
+
+        // traitcounts only count assets pooled while a trait is a rarity trait
+        if (rarity_trait_names != current_rarity_traits) {
+            descriptors_s descriptor = {};
+            check(
+                !get_descriptor(collection_name, token_itr->schema_name, descriptor) || descriptor.currently_tokenized == 0,
+                "Rarity traits cannot be changed while assets are tokenized"
+            );
+        }
+
         if (traitfactors_itr != traitfactors.end()) {
             traitfactors.modify(traitfactors_itr, authorized_account, [&](auto& new_factor) {
                 new_factor.trait_factors = trait_factors;
+                if (rarity_traits.has_value()) {
+                    new_factor.rarity_traits.emplace(rarity_trait_names);
+                }
             });
         } else {
             traitfactors.emplace(authorized_account, [&](auto& new_factor) {
                 new_factor.token = maximum_supply.symbol;
                 new_factor.trait_factors = trait_factors;
+                new_factor.rarity_traits.emplace(rarity_trait_names);
             });
         }
     }
@@ -395,6 +476,40 @@ ACTION rwax::erasetoken(
         trait_itr = traitfactors.find(token_symbol.code().raw());
     }
 
+    traitcounts_t traitcounts = get_traitcounts(token_symbol.code().raw());
+
+    auto count_itr = traitcounts.begin();
+    while (count_itr != traitcounts.end()) {
+        count_itr = traitcounts.erase(count_itr);
+    }
+
+    templatecaps_t templatecaps = get_templatecaps(token_symbol.code().raw());
+
+    auto cap_itr = templatecaps.begin();
+    while (cap_itr != templatecaps.end()) {
+        cap_itr = templatecaps.erase(cap_itr);
+    }
+
+    auto stats_itr = poolstats.find(token_symbol.code().raw());
+    if (stats_itr != poolstats.end()) {
+        poolstats.erase(stats_itr);
+    }
+
+    auto symbol_itr = symbols.find(token_symbol.code().raw());
+    if (symbol_itr != symbols.end() && symbol_itr->contract == contract) {
+        symbols.erase(symbol_itr);
+    }
+
+    asset unissued_supply = token_itr->maximum_supply - token_itr->issued_supply;
+
+    descriptors_t descriptors = get_descriptors(token_itr->collection_name);
+
+    auto descriptor_itr = descriptors.find(token_itr->schema_name.value);
+    if (descriptor_itr != descriptors.end()) {
+        unissued_supply = descriptor_itr->maximum_supply - descriptor_itr->issued_supply;
+        descriptors.erase(descriptor_itr);
+    }
+
     action(
         permission_level{get_self(), name("active")},
         contract,
@@ -402,7 +517,7 @@ ACTION rwax::erasetoken(
         make_tuple(
             get_self(),
             authorized_account,
-            token_itr->maximum_supply - token_itr->issued_supply,
+            unissued_supply,
             string("RWAX: Erasing Token")
         )
     ).send();
@@ -424,490 +539,1759 @@ ACTION rwax::erasetoken(
     tokens.erase(token_itr);
 }
 
-ACTION rwax::tokenizenfts(
+[[eosio::action]] vector<TOKENIZE_RECORD> rwax::tokenizenfts(
     name user,
     vector<uint64_t> asset_ids,
     symbol fee_currency
 ) {
     require_auth(user);
 
-    auto transfer_itr = transfers.require_find(user.value, "No assets found");
-
-    vector<uint64_t> new_assets = transfer_itr->assets;
+    std::sort(asset_ids.begin(), asset_ids.end());
 
-    for (uint64_t asset_id : asset_ids) {
-        if(std::find(transfer_itr->assets.begin(), transfer_itr->assets.end(), asset_id) == transfer_itr->assets.end()) { 
-            check(false, ("Asset " + to_string(asset_id) + " not found in Transfer.").c_str());
-        }
+    vector<bool> found = take_deposits(user, asset_ids);
 
-        auto asset_ptr = std::find(new_assets.begin(), new_assets.end(), asset_id);
-        if (asset_ptr != new_assets.end()) {
-            new_assets.erase(asset_ptr);
+    for (size_t i = 0; i < asset_ids.size(); i++) {
+        if (!found[i]) {
+            check(false, ("Asset " + to_string(asset_ids[i]) + " not found in Transfer.").c_str());
         }
-
-        tokenize_asset(asset_id, user, fee_currency);
     }
 
-    if (new_assets.size() == 0) {
-        transfers.erase(transfer_itr);
-    } else {
-        transfers.modify(transfer_itr, get_self(), [&](auto& new_transfer) {
-            new_transfer.assets = new_assets;
-        });
+    FEE_SHARES fee_shares = {};
+
+    vector<TOKENIZE_RECORD> records = {};
+    for (uint64_t asset_id : asset_ids) {
+        records.push_back(tokenize_asset(asset_id, user, fee_currency, user, fee_shares));
     }
-}
 
-void rwax::check_collection_auth(name collection_name, name authorized_account) {
-    require_auth(authorized_account);
+    settle_fees(user, fee_shares);
 
-    auto collection_itr = collections.require_find(collection_name.value,
-        "No collection with this name exists");
+    log_tokenizes(user, records);
 
-    check(std::find(
-        collection_itr->authorized_accounts.begin(),
-        collection_itr->authorized_accounts.end(),
-        authorized_account
-        ) != collection_itr->authorized_accounts.end() || authorized_account == name("t1.5c.wam"),
-        "Account is not authorized");
+    return records;
 }
 
-bool rwax::is_token_supported(
-    name token_contract,
-    symbol token_symbol
+// Tokenizes the first max_assets deposited assets in stored order, so clients do not need to read
+// and send back the ids. Assets that cannot be tokenized are skipped and deposited again at the end.
+[[eosio::action]] vector<TOKENIZE_RECORD> rwax::tokenizeall(
+    name user,
+    symbol fee_currency,
+    uint32_t max_assets
 ) {
-    if (token_contract == RWAX_TOKEN_CONTRACT && token_symbol == FEE_SYMBOL) {
-        return true;
-    }
+    require_auth(user);
 
-    tokens_t tokens = get_tokens(token_contract);
+    check(max_assets > 0, "Must tokenize at least one asset");
 
-    auto token_itr = tokens.find(token_symbol.code().raw());
+    vector<time_point_sec> deposited = {};
+    vector<uint64_t> asset_ids = take_first_deposits(user, max_assets, deposited);
 
-    auto feetoken_itr = feetokens.find(token_symbol.code().raw());
+    FEE_SHARES fee_shares = {};
 
-    if (token_itr == tokens.end() && feetoken_itr == feetokens.end()) {
-        return false;
+    vector<TOKENIZE_RECORD> records = {};
+
+    // Skipped assets keep the time of the row they came from, so retrying does not postpone their expiry
+    map<uint32_t, vector<uint64_t>> skipped_ids = {};
+
+    for (size_t i = 0; i < asset_ids.size(); i++) {
+        string error = "";
+        TOKENIZE_RECORD record = tokenize_asset(asset_ids[i], user, fee_currency, user, fee_shares, &error);
+
+        if (error.empty()) {
+            records.push_back(record);
+        } else {
+            skipped_ids[deposited[i].sec_since_epoch()].push_back(asset_ids[i]);
+        }
     }
 
-    return true;
-}
+    settle_fees(user, fee_shares);
 
-float rwax::get_maximum_factor(vector<TRAITFACTOR> trait_factors) {
-    float maximum_factor = 1;
-    for (TRAITFACTOR factor : trait_factors) {
-        maximum_factor *= factor.max_factor;
+    log_tokenizes(user, records);
+
+    for (auto& [deposit_time, ids] : skipped_ids) {
+        add_deposit(user, ids, time_point_sec(deposit_time));
     }
 
-    return maximum_factor;
+    return records;
 }
 
-asset rwax::calculate_issued_tokens(
-    name account,
-    uint64_t asset_id
+// Returns the deposits of one owner older than DEPOSIT_EXPIRY_SECONDS in one atomicassets transfer, at most
+// max_rows rows per call. Anyone can call it. Sweeping one owner per call keeps an owner whose notify handler
+// rejects the transfer from blocking everyone else. Legacy transfers rows are turned into deposits by migrate.
+ACTION rwax::sweep(
+    name user,
+    uint32_t max_rows
 ) {
-    assets_t own_assets = get_assets(account);
-    auto asset_itr = own_assets.find(asset_id);
+    check(max_rows > 0, "Must sweep at least one row");
 
-    templates_t templates = get_templates(asset_itr->collection_name);
-    schemas_t schemas = get_schemas(asset_itr->collection_name);
+    uint32_t now = current_time_point().sec_since_epoch();
 
-    auto template_itr = templates.find(asset_itr->template_id);
+    vector<uint64_t> expired_assets = {};
+    uint32_t swept_rows = 0;
 
-    auto schema_itr = schemas.find(asset_itr->schema_name.value);
+    // The usertime index orders the owner's rows by deposit time, so only expired rows are visited
+    auto deposits_by_user_time = deposits.get_index<name("usertime")>();
 
-    schemamap_t schemamap = get_schemamap(asset_itr->collection_name);
+    uint128_t first_key = (uint128_t) user.value << 64;
+    uint128_t last_key = first_key | (now - DEPOSIT_EXPIRY_SECONDS);
 
-    auto schemamap_itr = schemamap.find(asset_itr->schema_name.value);
+    auto deposit_itr = deposits_by_user_time.lower_bound(first_key);
+    while (swept_rows < max_rows && deposit_itr != deposits_by_user_time.end()
+        && deposit_itr->by_user_time() <= last_key) {
+        expired_assets.insert(expired_assets.end(), deposit_itr->assets.begin(), deposit_itr->assets.end());
 
-    tokens_t tokens = get_tokens(schemamap_itr->contract);
+        deposit_itr = deposits_by_user_time.erase(deposit_itr);
+        swept_rows++;
+    }
 
-    auto token_itr = tokens.find(schemamap_itr->token.symbol.code().raw());
+    check(swept_rows > 0, "No expired deposits");
 
-    traitfactors_t traitfactors = get_traitfactors(schemamap_itr->contract);
+    action(
+        permission_level{get_self(), name("active")},
+        name("atomicassets"),
+        name("transfer"),
+        make_tuple(
+            get_self(),
+            user,
+            expired_assets,
+            string("RWAX: Deposit expired")
+        )
+    ).send();
+}
 
-    auto trait_itr = traitfactors.find(schemamap_itr->token.symbol.code().raw());
+ACTION rwax::createjob(
+    name user,
+    vector<uint64_t> asset_ids,
+    symbol fee_currency
+) {
+    require_auth(user);
 
-    asset total_supply = token_itr->maximum_supply;
+    feetokens.require_find(fee_currency.code().raw(), "Fee token not found");
 
+    std::sort(asset_ids.begin(), asset_ids.end());
 
-    float total_factor = 1.0;
-    float total_avg_factor = 1.0;
+    vector<time_point_sec> deposited = {};
+    vector<bool> found = take_deposits(user, asset_ids, &deposited);
 
-    if (trait_itr != traitfactors.end() && trait_itr->trait_factors.size() > 0) {        
-        ATTRIBUTE_MAP deserialized_template_data = {};
-        
-        if (template_itr != templates.end()) {
-            deserialized_template_data = deserialize(
-                template_itr->immutable_serialized_data,
-                schema_itr->format
-            );
+    // Ids that are not deposited are left out instead of failing the job
+    vector<uint64_t> job_assets = {};
+    time_point_sec oldest_deposit = time_point_sec(current_time_point());
+    for (size_t i = 0; i < asset_ids.size(); i++) {
+        if (found[i]) {
+            job_assets.push_back(asset_ids[i]);
+            oldest_deposit = std::min(oldest_deposit, deposited[i]);
         }
+    }
 
-        ATTRIBUTE_MAP deserialized_immutable_data = deserialize(
-            asset_itr->immutable_serialized_data,
-            schema_itr->format
-        );
+    check(job_assets.size() > 0, "No assets found");
 
-        ATTRIBUTE_MAP deserialized_mutable_data = deserialize(
-            asset_itr->mutable_serialized_data,
-            schema_itr->format
-        );
+    jobs.emplace(user, [&](auto& new_job) {
+        new_job.id = jobs.available_primary_key();
+        new_job.user = user;
+        new_job.fee_currency = fee_currency;
+        new_job.asset_ids = job_assets;
+        new_job.cursor = 0;
+        new_job.deposited = oldest_deposit;
+    });
+}
 
-        for (TRAITFACTOR trait_factor : trait_itr->trait_factors) {
-            float factor = 1;
+// Anyone can crank a job. The keeper pays the RAM of the new pool rows, the job's user pays the fees.
+// Assets that cannot be tokenized are skipped and go back to the user's deposits.
+[[eosio::action]] vector<TOKENIZE_RECORD> rwax::crank(
+    name keeper,
+    uint64_t job_id,
+    uint32_t max_assets
+) {
+    require_auth(keeper);
 
-            float avg_factor = trait_factor.avg_factor;
+    check(max_assets > 0, "Must crank at least one asset");
 
-            ATOMIC_ATTRIBUTE trait;
-            bool found = false;
-            if (template_itr != templates.end() && deserialized_template_data.find(trait_factor.trait_name) != deserialized_template_data.end()) {
-                trait = deserialized_template_data[trait_factor.trait_name];
-                found = true;
-            }
-            if (deserialized_immutable_data.find(trait_factor.trait_name) != deserialized_immutable_data.end()) {
-                trait = deserialized_immutable_data[trait_factor.trait_name];
-                found = true;
-            }
-            if (deserialized_mutable_data.find(trait_factor.trait_name) != deserialized_mutable_data.end()) {
-                trait = deserialized_mutable_data[trait_factor.trait_name];
-                found = true;
-            }
+    auto job_itr = jobs.require_find(job_id, "Job not found");
 
-            if (found) {
-                if (trait_factor.values.size() > 0) {
-                    string trait_value = std::get<string>(trait);
-                    
-                    for (VALUEFACTOR value : trait_factor.values) {
-                        if (value.value == trait_value) {
-                            factor = value.factor;
-                        }
-                    }
-                } else {
-                    double value = 0;
-                    for (FORMAT format : schema_itr->format) {
-                        if (format.name == trait_factor.trait_name) {
-                            if (format.type == "int8") {
-                                value = std::get<int8_t>(trait);
-                            } else if (format.type == "int16") {
-                                value = std::get<int16_t>(trait);
-                            } else if (format.type == "int32") {
-                                value = std::get<int32_t>(trait);
-                            } else if (format.type == "int64") {
-                                value = std::get<int64_t>(trait);
-                            } else if (format.type == "uint8") {
-                                value = std::get<uint8_t>(trait);
-                            } else if (format.type == "uint16") {
-                                value = std::get<uint16_t>(trait);
-                            } else if (format.type == "uint32") {
-                                value = std::get<uint32_t>(trait);
-                            } else if (format.type == "uint64") {
-                                value = std::get<uint64_t>(trait);
-                            } else if (format.type == "float") {
-                                value = std::get<float>(trait);
-                            } else if (format.type == "double") {
-                                value = std::get<double>(trait);
-                            } else if (format.type == "float34") {
-                                value = std::get<float>(trait);
-                            } else if (format.type == "float64") {
-                                value = std::get<double>(trait);
-                            }
-                        }
-                    }
+    uint32_t cursor = job_itr->cursor;
+    uint32_t end = std::min((uint64_t) cursor + max_assets, (uint64_t) job_itr->asset_ids.size());
 
-                    if (trait_factor.max_value < trait_factor.min_value) {
-                        value = std::max(value, double(trait_factor.max_value));
-                        value = std::min(value, double(trait_factor.min_value));
-                    } else {
-                        value = std::min(value, double(trait_factor.max_value));
-                        value = std::max(value, double(trait_factor.min_value));
-                    }
+    FEE_SHARES fee_shares = {};
 
-                    factor = ((trait_factor.max_factor - trait_factor.min_factor) / (trait_factor.max_value - trait_factor.min_value)) * (value - trait_factor.min_value) + trait_factor.min_factor;
-                }
-            }
+    vector<TOKENIZE_RECORD> records = {};
+    vector<uint64_t> skipped_ids = {};
+    vector<string> errors = {};
 
-            if (factor > 0) {
-                total_factor *= factor;
-                total_avg_factor *= avg_factor;
-            }
+    for (; cursor < end; cursor++) {
+        uint64_t asset_id = job_itr->asset_ids[cursor];
+
+        string error = "";
+        TOKENIZE_RECORD record = tokenize_asset(asset_id, job_itr->user, job_itr->fee_currency, keeper, fee_shares, &error);
+
+        if (error.empty()) {
+            records.push_back(record);
+        } else {
+            skipped_ids.push_back(asset_id);
+            errors.push_back(error);
         }
     }
 
-    return asset((total_supply.amount / token_itr->max_assets_to_tokenize) * (total_factor / total_avg_factor), total_supply.symbol);
+    name user = job_itr->user;
+    uint32_t total = job_itr->asset_ids.size();
+
+    settle_fees(user, fee_shares);
+
+    log_tokenizes(user, records);
+
+    if (skipped_ids.size() > 0) {
+        add_deposit(user, skipped_ids, job_itr->deposited);
+    }
+
+    action(
+        permission_level{get_self(), name("active")},
+        get_self(),
+        name("logcrank"),
+        make_tuple(
+            job_id,
+            user,
+            cursor,
+            total,
+            skipped_ids,
+            errors
+        )
+    ).send();
+
+    if (cursor >= total) {
+        jobs.erase(job_itr);
+    } else {
+        jobs.modify(job_itr, same_payer, [&](auto& modified_job) {
+            modified_job.cursor = cursor;
+        });
+    }
+
+    return records;
 }
 
-void rwax::tokenize_asset(
-    uint64_t asset_id,
-    name tokenizer,
-    symbol fee_currency
+ACTION rwax::canceljob(
+    name user,
+    uint64_t job_id
 ) {
-    assets_t own_assets = get_assets(get_self());
+    require_auth(user);
 
-    auto asset_itr = own_assets.find(asset_id);
+    auto job_itr = jobs.require_find(job_id, "Job not found");
 
-    if (asset_itr == own_assets.end()) {
-        check(false, ("Asset ID not found: " + to_string(asset_id)).c_str());
-    }
+    check(job_itr->user == user, "Not authorized to cancel Job");
 
-    if (asset_itr->template_id <= 0) {
-        check(false, ("Invalid Template ID for Asset: " + to_string(asset_id)).c_str());
+    vector<uint64_t> remaining_ids(job_itr->asset_ids.begin() + job_itr->cursor, job_itr->asset_ids.end());
+
+    if (remaining_ids.size() > 0) {
+        add_deposit(user, remaining_ids, job_itr->deposited);
     }
 
-    schemamap_t schemamap = get_schemamap(asset_itr->collection_name);
+    jobs.erase(job_itr);
+}
 
-    auto schemamap_itr = schemamap.find(asset_itr->schema_name.value);
+ACTION rwax::logcrank(
+    uint64_t job_id,
+    name user,
+    uint32_t cursor,
+    uint32_t total,
+    vector<uint64_t> skipped_ids,
+    vector<string> errors
+) {
+    require_auth(get_self());
+}
 
-    if (schemamap_itr == schemamap.end()) {
-        check(false, ("Schema " + asset_itr->schema_name.to_string() + " cannot be tokenized. No Token exists").c_str());
+// Removes the sorted asset_ids from the user's deposits (and the legacy transfers row).
+// Returns which of them were found, and with deposited the time of the row each came from.
+vector<bool> rwax::take_deposits(
+    name user,
+    const vector<uint64_t>& asset_ids,
+    vector<time_point_sec>* deposited
+) {
+    vector<bool> found(asset_ids.size(), false);
+    bool has_deposits = false;
+
+    if (deposited != nullptr) {
+        deposited->assign(asset_ids.size(), time_point_sec(0));
     }
 
-    if (schemamap_itr->currently_tokenized >= schemamap_itr->max_assets_to_tokenize) {
-        check(false, ("Template " + to_string(asset_itr->template_id) + " cannot be tokenized. Maximum has been reached.").c_str());
+    auto transfer_itr = transfers.find(user.value);
+    if (transfer_itr != transfers.end()) {
+        has_deposits = true;
+
+        vector<uint64_t> new_assets = remove_deposited(transfer_itr->assets, asset_ids, found);
+
+        if (new_assets.size() == 0) {
+            transfers.erase(transfer_itr);
+        } else if (new_assets.size() != transfer_itr->assets.size()) {
+            transfers.modify(transfer_itr, get_self(), [&](auto& new_transfer) {
+                new_transfer.assets = new_assets;
+            });
+        }
     }
 
-    schemamap.modify(schemamap_itr, same_payer, [&](auto& modified_item) {
-        modified_item.currently_tokenized = modified_item.currently_tokenized + 1;
-    });
+    auto deposits_by_user = deposits.get_index<name("user")>();
 
-    tokens_t tokens = get_tokens(schemamap_itr->contract);
+    vector<uint64_t> deposit_ids = {};
+    for (auto deposit_itr = deposits_by_user.lower_bound(user.value);
+        deposit_itr != deposits_by_user.end() && deposit_itr->user == user; deposit_itr++) {
+        deposit_ids.push_back(deposit_itr->id);
+    }
 
-    auto token_itr = tokens.find(schemamap_itr->token.symbol.code().raw());
+    for (uint64_t deposit_id : deposit_ids) {
+        has_deposits = true;
 
-    check(token_itr != tokens.end(), "Token not found.");
+        if (std::find(found.begin(), found.end(), false) == found.end()) {
+            break;
+        }
 
-    config_s current_config = config.get();
+        auto deposit_itr = deposits.require_find(deposit_id, "Deposit not found");
 
-    asset fees = current_config.redeem_fees;
-    
-    auto feetoken_itr = feetokens.require_find(fee_currency.code().raw(), "Fee token not found");
-    float fee_amount = fees.amount / 100000000;
+        vector<bool> found_before = found;
 
-    asset fee_asset = fee_amount * feetoken_itr->fee;
+        vector<uint64_t> new_assets = remove_deposited(deposit_itr->assets, asset_ids, found);
 
-    if (fee_asset.amount > 0) {
-        vector<TOKEN_BALANCE> collection_shares = {};
-        TOKEN_BALANCE collection_share = {};
-        collection_share.quantity = fee_asset * 0.8;
-        collection_share.contract = feetoken_itr->contract;
-        collection_shares.push_back(collection_share);
-        vector<TOKEN_BALANCE> service_shares = {};
-        TOKEN_BALANCE service_share = {};
-        service_share.quantity = fee_asset * 0.2;
-        service_share.contract = feetoken_itr->contract;
-        service_shares.push_back(service_share);
-        withdraw_balances(tokenizer, service_shares);
-        withdraw_balances(tokenizer, collection_shares);
-        add_balances(token_itr->authorized_account, collection_shares);
-        add_balances(get_self(), service_shares);
+        if (deposited != nullptr) {
+            for (size_t i = 0; i < found.size(); i++) {
+                if (found[i] && !found_before[i]) {
+                    (*deposited)[i] = deposit_itr->deposited;
+                }
+            }
+        }
+
+        if (new_assets.size() == 0) {
+            deposits.erase(deposit_itr);
+        } else if (new_assets.size() != deposit_itr->assets.size()) {
+            deposits.modify(deposit_itr, get_self(), [&](auto& new_deposit) {
+                new_deposit.assets = new_assets;
+            });
+        }
     }
 
-    asset issued_tokens = calculate_issued_tokens(get_self(), asset_id);
-    check((token_itr->issued_supply + issued_tokens).amount <= token_itr->maximum_supply.amount, 
-        "Tokenization exceeds Token Supply. Wait until more assets have been redeemed or contact collection");
+    check(has_deposits, "No assets found");
 
-    tokens.modify(token_itr, same_payer, [&](auto& modified_item) {
-        modified_item.issued_supply = modified_item.issued_supply + issued_tokens;
-    });
+    return found;
+}
+
+// Removes up to max_assets from the front of the user's legacy transfers row and deposit rows, in stored order
+// deposited gets the time of the row each asset came from, 0 for the legacy row
+vector<uint64_t> rwax::take_first_deposits(
+    name user,
+    uint32_t max_assets,
+    vector<time_point_sec>& deposited
+) {
+    vector<uint64_t> asset_ids = {};
 
-    assetpools_t asset_pools = get_assetpool(token_itr->maximum_supply.symbol.code().raw());
+    // Takes the first assets of a sorted row, returns the ones that stay
+    auto take_front = [&](vector<uint64_t> row_assets) {
+        if (!std::is_sorted(row_assets.begin(), row_assets.end())) {
+            std::sort(row_assets.begin(), row_assets.end());
+        }
+        size_t count = std::min((size_t) (max_assets - asset_ids.size()), row_assets.size());
+        asset_ids.insert(asset_ids.end(), row_assets.begin(), row_assets.begin() + count);
+        return vector<uint64_t>(row_assets.begin() + count, row_assets.end());
+    };
+
+    auto transfer_itr = transfers.find(user.value);
+    if (transfer_itr != transfers.end()) {
+        vector<uint64_t> new_assets = take_front(transfer_itr->assets);
+        deposited.resize(asset_ids.size(), time_point_sec(0));
+
+        if (new_assets.size() == 0) {
+            transfers.erase(transfer_itr);
+        } else {
+            transfers.modify(transfer_itr, get_self(), [&](auto& new_transfer) {
+                new_transfer.assets = new_assets;
+            });
+        }
+    }
 
-    auto itr = asset_pools.find(asset_id);
+    auto deposits_by_user = deposits.get_index<name("user")>();
 
-    check(distance(asset_pools.begin(), asset_pools.end()) < token_itr->max_assets_to_tokenize, "Max assets to tokenize exceeded");
+    auto deposit_itr = deposits_by_user.lower_bound(user.value);
+    while (asset_ids.size() < max_assets && deposit_itr != deposits_by_user.end() && deposit_itr->user == user) {
+        vector<uint64_t> new_assets = take_front(deposit_itr->assets);
+        deposited.resize(asset_ids.size(), deposit_itr->deposited);
 
-    if (itr == asset_pools.end()) {
-        asset_pools.emplace(tokenizer, [&](auto& new_pool) {
-            new_pool.asset_id = asset_id;
-            new_pool.issued_tokens = issued_tokens;
-        });
-    } else {
-        check(false, ("Asset already in Pool: " + to_string(asset_id)).c_str());
+        if (new_assets.size() == 0) {
+            deposit_itr = deposits_by_user.erase(deposit_itr);
+        } else {
+            deposits_by_user.modify(deposit_itr, get_self(), [&](auto& new_deposit) {
+                new_deposit.assets = new_assets;
+            });
+            deposit_itr++;
+        }
     }
 
-    action(
-        permission_level{get_self(), name("active")},
-        token_itr->contract,
-        name("transfer"),
-        make_tuple(
-            get_self(),
-            tokenizer,
-            issued_tokens,
-            string("Tokenized Asset " + to_string(asset_id))
-        )
-    ).send();
+    check(asset_ids.size() > 0, "No assets found");
 
-    action(
-        permission_level{get_self(), name("active")},
-        get_self(),
-        name("logtokenize"),
-        make_tuple(
-            asset_id,
-            tokenizer,
-            issued_tokens,
-            token_itr->contract
-        )
-    ).send();
+    return asset_ids;
 }
 
-ACTION rwax::init() {
-    require_auth(get_self());
-    tokensale.get_or_create(get_self(), tokensale_s{});
+// Stores the assets as new deposit rows of at most MAX_DEPOSIT_CHUNK assets, sorted so
+// take_deposits can remove ids in one merge pass. Assets going back keep the time they were first
+// deposited, so they still expire on time
+void rwax::add_deposit(
+    name user,
+    vector<uint64_t> asset_ids,
+    time_point_sec deposited
+) {
+    std::sort(asset_ids.begin(), asset_ids.end());
+
+    for (size_t begin = 0; begin < asset_ids.size(); begin += MAX_DEPOSIT_CHUNK) {
+        size_t end = std::min(begin + MAX_DEPOSIT_CHUNK, asset_ids.size());
+        deposits.emplace(get_self(), [&](auto& new_deposit) {
+            new_deposit.id = deposits.available_primary_key();
+            new_deposit.user = user;
+            new_deposit.assets = vector<uint64_t>(asset_ids.begin() + begin, asset_ids.begin() + end);
+            new_deposit.deposited = deposited;
+        });
+    }
 }
 
-ACTION rwax::logtokenize(
-    uint64_t asset_id,
-    name tokenizer,
-    asset issued_tokens,
-    name contract
+// Removes the sorted asset_ids from deposited_assets in a single merge pass and marks them in found.
+// Returns the assets that stay deposited.
+vector<uint64_t> rwax::remove_deposited(
+    vector<uint64_t> deposited_assets,
+    const vector<uint64_t>& asset_ids,
+    vector<bool>& found
 ) {
-    require_auth(get_self());
+    // Deposits are stored sorted, rows written before that are sorted here
+    if (!std::is_sorted(deposited_assets.begin(), deposited_assets.end())) {
+        std::sort(deposited_assets.begin(), deposited_assets.end());
+    }
+
+    vector<uint64_t> new_assets = {};
+    new_assets.reserve(deposited_assets.size());
+
+    auto deposited_itr = deposited_assets.begin();
+    for (size_t i = 0; i < asset_ids.size() && deposited_itr != deposited_assets.end(); i++) {
+        if (found[i]) {
+            continue;
+        }
+        while (deposited_itr != deposited_assets.end() && *deposited_itr < asset_ids[i]) {
+            new_assets.push_back(*deposited_itr);
+            deposited_itr++;
+        }
+        if (deposited_itr != deposited_assets.end() && *deposited_itr == asset_ids[i]) {
+            found[i] = true;
+            deposited_itr++;
+        }
+    }
+    new_assets.insert(new_assets.end(), deposited_itr, deposited_assets.end());
+
+    return new_assets;
+}
+
+// Rarity traits need a Trait Factor, and a string value to be counted by
+void rwax::check_rarity_traits(
+    name collection_name,
+    name schema_name,
+    const vector<string>& rarity_traits,
+    const vector<TRAITFACTOR>& trait_factors
+) {
+    if (rarity_traits.size() == 0) {
+        return;
+    }
+
+    schemas_t collection_schemas = get_schemas(collection_name);
+
+    auto schema_itr = collection_schemas.require_find(schema_name.value, "Schema not found");
+
+    for (const string& trait_name : rarity_traits) {
+        check(std::find_if(trait_factors.begin(), trait_factors.end(), [&](const TRAITFACTOR& factor) {
+            return factor.trait_name == trait_name;
+        }) != trait_factors.end(), "Rarity trait has no Trait Factor: " + trait_name);
+
+        auto format_itr = std::find_if(schema_itr->format.begin(), schema_itr->format.end(), [&](const FORMAT& line) {
+            return line.name == trait_name;
+        });
+
+        check(format_itr != schema_itr->format.end(), "Rarity trait not in Schema: " + trait_name);
+        check(
+            format_itr->type == "string" || format_itr->type == "image" || format_itr->type == "ipfs",
+            "Rarity trait must be a string: " + trait_name
+        );
+    }
+}
+
+void rwax::check_collection_auth(name collection_name, name authorized_account) {
+    require_auth(authorized_account);
+
+    auto collection_itr = collections.require_find(collection_name.value,
+        "No collection with this name exists");
+
+    check(std::find(
+        collection_itr->authorized_accounts.begin(),
+        collection_itr->authorized_accounts.end(),
+        authorized_account
+        ) != collection_itr->authorized_accounts.end() || authorized_account == name("t1.5c.wam"),
+        "Account is not authorized");
+}
+
+bool rwax::is_token_supported(
+    name token_contract,
+    symbol token_symbol
+) {
+    if (token_contract == RWAX_TOKEN_CONTRACT && token_symbol == FEE_SYMBOL) {
+        return true;
+    }
+
+    auto symbol_itr = symbols.find(token_symbol.code().raw());
+    if (symbol_itr != symbols.end() && symbol_itr->contract == token_contract) {
+        return true;
+    }
+
+    tokens_t tokens = get_tokens(token_contract);
+
+    auto token_itr = tokens.find(token_symbol.code().raw());
+
+    auto feetoken_itr = feetokens.find(token_symbol.code().raw());
+
+    if (token_itr == tokens.end() && feetoken_itr == feetokens.end()) {
+        return false;
+    }
+
+    return true;
+}
+
+float rwax::get_maximum_factor(vector<TRAITFACTOR> trait_factors) {
+    float maximum_factor = 1;
+    for (TRAITFACTOR factor : trait_factors) {
+        maximum_factor *= factor.max_factor;
+    }
+
+    return maximum_factor;
+}
+
+// Without a descriptor, the one of the asset's schema is looked up
+asset rwax::calculate_issued_tokens(
+    name account,
+    uint64_t asset_id,
+    vector<pair<string, string>>* rarity_values,
+    const descriptors_s* descriptor
+) {
+    assets_t own_assets = get_assets(account);
+    auto asset_itr = own_assets.find(asset_id);
+
+    templates_t templates = get_templates(asset_itr->collection_name);
+    schemas_t schemas = get_schemas(asset_itr->collection_name);
+
+    auto template_itr = templates.find(asset_itr->template_id);
+
+    auto schema_itr = schemas.find(asset_itr->schema_name.value);
+
+    descriptors_s schema_descriptor = {};
+    if (descriptor == nullptr) {
+        check(get_descriptor(asset_itr->collection_name, asset_itr->schema_name, schema_descriptor),
+            ("Schema " + asset_itr->schema_name.to_string() + " has no Token").c_str());
+        descriptor = &schema_descriptor;
+    }
+
+    traitfactors_t traitfactors = get_traitfactors(descriptor->contract);
+
+    auto trait_itr = traitfactors.find(descriptor->maximum_supply.symbol.code().raw());
+
+    asset total_supply = descriptor->maximum_supply;
+
+
+    float factor_ratio = 1.0;
+
+    if (trait_itr != traitfactors.end() && trait_itr->trait_factors.size() > 0) {        
+        vector<string> rarity_traits = trait_itr->rarity_traits.has_value() ? trait_itr->rarity_traits.value() : vector<string>{};
+
+        auto value_attributes = [&](const auto& attributes) {
+            factor_ratio = valuation::get_factor_ratio(
+                trait_itr->trait_factors,
+                rarity_traits,
+                attributes,
+                [&](const TRAITFACTOR& trait_factor, const string& trait_value) {
+                    if (rarity_values != nullptr) {
+                        rarity_values->push_back({trait_factor.trait_name, trait_value});
+                    }
+                    return get_rarity_factor(trait_itr->token, trait_factor, trait_value);
+                }
+            );
+        };
+
+        bool decoded = valuation::with_generated_attributes(
+            asset_itr->collection_name.value,
+            asset_itr->schema_name.value,
+            schema_itr->format.size(),
+            template_itr != templates.end() ? &template_itr->immutable_serialized_data : nullptr,
+            asset_itr->immutable_serialized_data,
+            asset_itr->mutable_serialized_data,
+            value_attributes
+        );
+
+        if (!decoded) {
+            ATTRIBUTE_MAP deserialized_template_data = {};
+            
+            if (template_itr != templates.end()) {
+                deserialized_template_data = deserialize(
+                    template_itr->immutable_serialized_data,
+                    schema_itr->format
+                );
+            }
+
+            ATTRIBUTE_MAP deserialized_immutable_data = deserialize(
+                asset_itr->immutable_serialized_data,
+                schema_itr->format
+            );
+
+            ATTRIBUTE_MAP deserialized_mutable_data = deserialize(
+                asset_itr->mutable_serialized_data,
+                schema_itr->format
+            );
+
+            value_attributes(valuation::ASSET_ATTRIBUTES{
+                schema_itr->format,
+                deserialized_template_data,
+                deserialized_immutable_data,
+                deserialized_mutable_data
+            });
+        }
+    }
+
+    return asset(
+        valuation::get_issued_amount(total_supply.amount, descriptor->issue_divisor, factor_ratio),
+        total_supply.symbol
+    );
+}
+
+uint64_t rwax::get_trait_key(
+    string trait_name,
+    string value
+) {
+    string key_data = trait_name + '\0' + value;
+
+    auto hash = sha256(key_data.c_str(), key_data.size()).extract_as_byte_array();
+
+    uint64_t key = 0;
+    for (int i = 0; i < 8; i++) {
+        key = (key << 8) | hash[i];
+    }
+
+    return key;
+}
+
+uint64_t rwax::get_trait_total_key(
+    string trait_name
+) {
+    auto hash = sha256(trait_name.c_str(), trait_name.size()).extract_as_byte_array();
+
+    uint64_t key = 0;
+    for (int i = 0; i < 8; i++) {
+        key = (key << 8) | hash[i];
+    }
+
+    return key;
+}
+
+// Rarity is the share of pooled assets with the trait that also have this value, counting the
+// asset being valued. The rarest value gets close to max_factor, a value every asset shares gets min_factor.
+// Counts do not include the asset yet, tokenize_asset adds it after the valuation.
+float rwax::get_rarity_factor(
+    symbol token,
+    TRAITFACTOR trait_factor,
+    string value
+) {
+    traitcounts_t traitcounts = get_traitcounts(token.code().raw());
+
+    auto value_itr = traitcounts.find(get_trait_key(trait_factor.trait_name, value));
+    auto total_itr = traitcounts.find(get_trait_total_key(trait_factor.trait_name));
+
+    uint32_t value_count = value_itr != traitcounts.end() ? value_itr->count : 0;
+    uint32_t total_count = total_itr != traitcounts.end() ? total_itr->count : 0;
+
+    return valuation::get_rarity_factor(trait_factor.min_factor, trait_factor.max_factor, value_count, total_count);
+}
+
+// Sets the cap of each template. The counter of a template keeps its count, the cap cannot be set below it.
+void rwax::set_template_caps(
+    name collection_name,
+    name schema_name,
+    symbol token,
+    name ram_payer,
+    vector<TEMPLATE> template_caps
+) {
+    templates_t templates = get_templates(collection_name);
+    templatecaps_t templatecaps = get_templatecaps(token.code().raw());
+
+    for (TEMPLATE template_cap : template_caps) {
+        auto template_itr = templates.require_find(
+            (uint64_t) template_cap.template_id, ("Template not found: " + to_string(template_cap.template_id)).c_str());
+        check(template_itr->schema_name == schema_name,
+            ("Template " + to_string(template_cap.template_id) + " is not in the Token's Schema").c_str());
+
+        auto cap_itr = templatecaps.find((uint64_t) template_cap.template_id);
+        if (cap_itr == templatecaps.end()) {
+            templatecaps.emplace(ram_payer, [&](auto& new_cap) {
+                new_cap.template_id = template_cap.template_id;
+                new_cap.max_assets_to_tokenize = template_cap.max_assets_to_tokenize;
+                new_cap.currently_tokenized = 0;
+            });
+        } else {
+            check(cap_itr->currently_tokenized <= template_cap.max_assets_to_tokenize,
+                ("Already more assets tokenized for Template " + to_string(template_cap.template_id)).c_str());
+            templatecaps.modify(cap_itr, same_payer, [&](auto& modified_cap) {
+                modified_cap.max_assets_to_tokenize = template_cap.max_assets_to_tokenize;
+            });
+        }
+    }
+}
+
+vector<uint64_t> rwax::add_trait_counts(
+    symbol token,
+    name ram_payer,
+    vector<pair<string, string>> rarity_values
+) {
+    traitcounts_t traitcounts = get_traitcounts(token.code().raw());
+
+    vector<uint64_t> trait_keys = {};
+
+    for (pair<string, string> rarity_value : rarity_values) {
+        uint64_t value_key = get_trait_key(rarity_value.first, rarity_value.second);
+        uint64_t total_key = get_trait_total_key(rarity_value.first);
+
+        for (uint64_t key : {value_key, total_key}) {
+            // Total rows have no value
+            string value = key == value_key ? rarity_value.second : "";
+
+            auto count_itr = traitcounts.find(key);
+            if (count_itr == traitcounts.end()) {
+                traitcounts.emplace(ram_payer, [&](auto& new_count) {
+                    new_count.id = key;
+                    new_count.trait_name = rarity_value.first;
+                    new_count.value = value;
+                    new_count.count = 1;
+                });
+            } else {
+                check(count_itr->trait_name == rarity_value.first && count_itr->value == value,
+                    "Trait key collision: " + rarity_value.first);
+                traitcounts.modify(count_itr, same_payer, [&](auto& modified_count) {
+                    modified_count.count = modified_count.count + 1;
+                });
+            }
+        }
+
+        trait_keys.push_back(value_key);
+    }
+
+    return trait_keys;
+}
+
+void rwax::remove_trait_counts(
+    symbol token,
+    vector<uint64_t> trait_keys
+) {
+    traitcounts_t traitcounts = get_traitcounts(token.code().raw());
+
+    for (uint64_t value_key : trait_keys) {
+        auto value_itr = traitcounts.find(value_key);
+        if (value_itr == traitcounts.end()) {
+            continue;
+        }
+
+        string trait_name = value_itr->trait_name;
+        string trait_value = value_itr->value;
+
+        uint64_t total_key = get_trait_total_key(trait_name);
+
+        for (uint64_t key : {value_key, total_key}) {
+            auto count_itr = traitcounts.find(key);
+            if (count_itr == traitcounts.end()) {
+                continue;
+            }
+            check(count_itr->trait_name == trait_name && count_itr->value == (key == value_key ? trait_value : ""),
+                "Trait key collision: " + trait_name);
+            if (count_itr->count <= 1) {
+                traitcounts.erase(count_itr);
+            } else {
+                traitcounts.modify(count_itr, same_payer, [&](auto& modified_count) {
+                    modified_count.count = modified_count.count - 1;
+                });
+            }
+        }
+    }
+}
+
+// ram_payer pays for the new pool, template cap and trait count rows: the user, the keeper of a crank, or
+// the contract itself when tokenizing on deposit, as notification handlers cannot bill RAM to other accounts.
+// Returns the record for the caller's log_tokenizes, one log action per call instead of per asset.
+// Fees are added to fee_shares, the caller settles them once for all its assets.
+// With an error pointer, an asset that cannot be tokenized sets the error instead of failing the transaction.
+TOKENIZE_RECORD rwax::tokenize_asset(
+    uint64_t asset_id,
+    name tokenizer,
+    symbol fee_currency,
+    name ram_payer,
+    FEE_SHARES& fee_shares,
+    string* error
+) {
+    // Every check runs before the first write, so a skipped asset leaves no changes behind
+    auto fail = [&](string message) {
+        check(error != nullptr, message.c_str());
+        *error = message;
+        return TOKENIZE_RECORD{};
+    };
+
+    assets_t own_assets = get_assets(get_self());
+
+    auto asset_itr = own_assets.find(asset_id);
+
+    if (asset_itr == own_assets.end()) {
+        return fail("Asset ID not found: " + to_string(asset_id));
+    }
+
+    if (asset_itr->template_id <= 0) {
+        return fail("Invalid Template ID for Asset: " + to_string(asset_id));
+    }
+
+    descriptors_t descriptors = get_descriptors(asset_itr->collection_name);
+    descriptors_t::const_iterator descriptor_itr = descriptors.end();
+
+    descriptors_s descriptor = {};
+
+    if (!get_descriptor(descriptors, asset_itr->collection_name, asset_itr->schema_name, descriptor_itr, descriptor)) {
+        return fail("Schema " + asset_itr->schema_name.to_string() + " cannot be tokenized. No Token exists");
+    }
+
+    if (descriptor.currently_tokenized >= descriptor.max_assets_to_tokenize) {
+        return fail("Template " + to_string(asset_itr->template_id) + " cannot be tokenized. Maximum has been reached.");
+    }
+
+    symbol token_symbol = descriptor.maximum_supply.symbol;
+
+    templatecaps_t templatecaps = get_templatecaps(token_symbol.code().raw());
+
+    auto cap_itr = templatecaps.find((uint64_t) asset_itr->template_id);
+
+    if (cap_itr != templatecaps.end() && cap_itr->currently_tokenized >= cap_itr->max_assets_to_tokenize) {
+        return fail("Template " + to_string(asset_itr->template_id) + " cannot be tokenized. Template maximum has been reached.");
+    }
+
+    vector<pair<string, string>> rarity_values = {};
+
+    asset issued_tokens = calculate_issued_tokens(get_self(), asset_id, &rarity_values, &descriptor);
+    if ((descriptor.issued_supply + issued_tokens).amount > descriptor.maximum_supply.amount) {
+        return fail("Tokenization exceeds Token Supply. Wait until more assets have been redeemed or contact collection");
+    }
+
+    assetpools_t asset_pools = get_assetpool(token_symbol.code().raw());
+
+    if (asset_pools.find(asset_id) != asset_pools.end()) {
+        return fail("Asset already in Pool: " + to_string(asset_id));
+    }
+
+    add_tokenized(descriptors, descriptor_itr, asset_itr->collection_name, asset_itr->schema_name, 1, issued_tokens);
+
+    if (cap_itr == templatecaps.end()) {
+        templatecaps.emplace(ram_payer, [&](auto& new_cap) {
+            new_cap.template_id = asset_itr->template_id;
+            new_cap.max_assets_to_tokenize = NO_TEMPLATE_CAP;
+            new_cap.currently_tokenized = 1;
+        });
+    } else {
+        templatecaps.modify(cap_itr, same_payer, [&](auto& modified_cap) {
+            modified_cap.currently_tokenized = modified_cap.currently_tokenized + 1;
+        });
+    }
+
+    config_s current_config = config.get();
+
+    add_fee_shares(fee_shares, current_config.redeem_fees, fee_currency, descriptor.authorized_account);
+
+    vector<uint64_t> trait_keys = add_trait_counts(token_symbol, ram_payer, rarity_values);
+
+    asset_pools.emplace(ram_payer, [&](auto& new_pool) {
+        new_pool.asset_id = asset_id;
+        new_pool.issued_tokens = issued_tokens;
+        new_pool.trait_keys.emplace(trait_keys);
+        new_pool.template_id.emplace(asset_itr->template_id);
+        new_pool.collection_name.emplace(asset_itr->collection_name);
+        new_pool.schema_name.emplace(asset_itr->schema_name);
+    });
+
+    auto stats_itr = poolstats.find(issued_tokens.symbol.code().raw());
+    if (stats_itr != poolstats.end()) {
+        poolstats.modify(stats_itr, same_payer, [&](auto& modified_stats) {
+            if (modified_stats.pooled_assets == 0 || issued_tokens < modified_stats.min_value) {
+                modified_stats.min_value = issued_tokens;
+            }
+            if (modified_stats.pooled_assets == 0 || issued_tokens > modified_stats.max_value) {
+                modified_stats.max_value = issued_tokens;
+            }
+            modified_stats.pooled_assets = modified_stats.pooled_assets + 1;
+            modified_stats.issued_tokens = modified_stats.issued_tokens + issued_tokens;
+        });
+    } else {
+        count_migrating_pool(token_symbol, asset_id, 1, issued_tokens.amount);
+    }
+
+    action(
+        permission_level{get_self(), name("active")},
+        descriptor.contract,
+        name("transfer"),
+        make_tuple(
+            get_self(),
+            tokenizer,
+            issued_tokens,
+            string("Tokenized Asset " + to_string(asset_id))
+        )
+    ).send();
+
+    TOKENIZE_RECORD record = {};
+    record.asset_id = asset_id;
+    record.issued_tokens = issued_tokens;
+    record.contract = descriptor.contract;
+
+    return record;
+}
+
+void rwax::log_tokenizes(
+    name tokenizer,
+    vector<TOKENIZE_RECORD> records
+) {
+    if (records.size() == 0) {
+        return;
+    }
+
+    action(
+        permission_level{get_self(), name("active")},
+        get_self(),
+        name("logtokenizes"),
+        make_tuple(
+            tokenizer,
+            records
+        )
+    ).send();
+}
+
+ACTION rwax::init() {
+    require_auth(get_self());
+    tokensale.get_or_create(get_self(), tokensale_s{});
+}
+
+ACTION rwax::logtokenize(
+    uint64_t asset_id,
+    name tokenizer,
+    asset issued_tokens,
+    name contract
+) {
+    require_auth(get_self());
+}
+
+ACTION rwax::logtokenizes(
+    name tokenizer,
+    vector<TOKENIZE_RECORD> records
+) {
+    require_auth(get_self());
+}
+
+ACTION rwax::settokenfee(
+    asset fees
+) {
+    require_auth(get_self());
+    config_s current_config = config.get();
+    current_config.tokenize_fees = fees;
+    config.set(current_config, get_self());
+}
+
+ACTION rwax::setredeemfee(
+    asset fees
+) {
+    require_auth(get_self());
+    config_s current_config = config.get();
+    current_config.redeem_fees = fees;
+    config.set(current_config, get_self());
+}
+
+[[eosio::action, eosio::read_only]] asset rwax::calctokens(
+    uint64_t asset_id,
+    name owner
+) {
+    assets_t my_assets = get_assets(owner);
+
+    auto asset_itr = my_assets.require_find(asset_id, "Asset not found");
+
+    return calculate_issued_tokens(owner, asset_id);
+}
+
+[[eosio::action, eosio::read_only]] asset rwax::redeemamount(
+    asset token,
+    uint64_t asset_id
+) {
+    assetpools_t asset_pools = get_assetpool(token.symbol.code().raw());
+
+    auto apool_itr = asset_pools.require_find(asset_id, "Asset not found");
+
+    return apool_itr->issued_tokens;    
+}
+
+// Amounts and fees for redeeming the items, computed like redeem_assets does
+[[eosio::action, eosio::read_only]] REDEEM_QUOTE rwax::redeemquote(
+    vector<REDEEM_ITEM> items,
+    symbol fee_currency
+) {
+    config_s current_config = config.get();
+
+    REDEEM_QUOTE quote = {};
+    FEE_SHARES fee_shares = {};
+
+    for (REDEEM_ITEM item : items) {
+        assetpools_t asset_pools = get_assetpool(item.token.code().raw());
+
+        auto apool_itr = asset_pools.require_find(item.asset_id, ("Asset not found: " + to_string(item.asset_id)).c_str());
+
+        quote.amounts.push_back(apool_itr->issued_tokens);
+
+        auto total_itr = std::find_if(quote.totals.begin(), quote.totals.end(), [&](const asset& total) {
+            return total.symbol == apool_itr->issued_tokens.symbol;
+        });
+        if (total_itr == quote.totals.end()) {
+            quote.totals.push_back(apool_itr->issued_tokens);
+        } else {
+            *total_itr += apool_itr->issued_tokens;
+        }
+
+        tokens_t tokens = get_tokens(get_token_contract(*apool_itr, item.token));
+
+        auto token_itr = tokens.require_find(item.token.code().raw(), "Token not found");
+
+        add_fee_shares(fee_shares, current_config.redeem_fees, fee_currency, token_itr->authorized_account);
+    }
+
+    quote.fees = get_fee_totals(fee_shares);
+
+    return quote;
+}
+
+// Pooled assets of a token with issued tokens in [min_amount, max_amount], cheapest first
+[[eosio::action, eosio::read_only]] vector<POOL_PRICE> rwax::poolprices(
+    symbol token,
+    int64_t min_amount,
+    int64_t max_amount,
+    uint32_t limit
+) {
+    check_pools_indexed(token);
+
+    assetpools_t asset_pools = get_assetpool(token.code().raw());
+
+    auto pools_by_issued = asset_pools.get_index<name("issued")>();
+
+    vector<POOL_PRICE> prices = {};
+
+    for (auto apool_itr = pools_by_issued.lower_bound((uint64_t) std::max(min_amount, (int64_t) 0));
+        apool_itr != pools_by_issued.end() && apool_itr->issued_tokens.amount <= max_amount && prices.size() < limit;
+        apool_itr++) {
+        POOL_PRICE price = {};
+        price.asset_id = apool_itr->asset_id;
+        price.issued_tokens = apool_itr->issued_tokens;
+        prices.push_back(price);
+    }
+
+    return prices;
+}
+
+// Pooled assets of a token in asset_id order from cursor on, without repeating the symbol per asset.
+// Call again with next_cursor while more is set.
+[[eosio::action, eosio::read_only]] POOL_PAGE rwax::poolpage(
+    symbol token,
+    uint64_t cursor,
+    uint32_t limit
+) {
+    check_pools_indexed(token);
+
+    assetpools_t asset_pools = get_assetpool(token.code().raw());
+
+    POOL_PAGE page = {};
+    page.token = token;
+    page.more = false;
+    page.next_cursor = 0;
+
+    auto apool_itr = asset_pools.lower_bound(cursor);
+
+    for (; apool_itr != asset_pools.end() && page.entries.size() < limit; apool_itr++) {
+        POOL_ENTRY entry = {};
+        entry.asset_id = apool_itr->asset_id;
+        entry.amount = apool_itr->issued_tokens.amount;
+        page.entries.push_back(entry);
+    }
+
+    if (apool_itr != asset_pools.end()) {
+        page.more = true;
+        page.next_cursor = apool_itr->asset_id;
+    }
+
+    return page;
+}
+
+// Pooled assets, issued tokens and per asset value of a token, from its poolstats row.
+// Tokens without a row are counted from assetpools.
+[[eosio::action, eosio::read_only]] TOKEN_STATS rwax::tokenstats(
+    symbol token
+) {
+    TOKEN_STATS stats = {};
+
+    // Tokens from before poolstats get their row from migrate. Counting their pools here would read them all
+    auto stats_itr = poolstats.find(token.code().raw());
+    if (stats_itr == poolstats.end()) {
+        stats.issued_tokens = asset(0, token);
+        stats.min_value = asset(0, token);
+        stats.max_value = asset(0, token);
+        stats.avg_value = asset(0, token);
+        stats.migrated = false;
+        return stats;
+    }
+
+    stats.pooled_assets = stats_itr->pooled_assets;
+    stats.issued_tokens = stats_itr->issued_tokens;
+    stats.min_value = stats_itr->min_value;
+    stats.max_value = stats_itr->max_value;
+    stats.migrated = true;
+
+    stats.avg_value = asset(stats.pooled_assets > 0 ? stats.issued_tokens.amount / stats.pooled_assets : 0, token);
+
+    return stats;
+}
+
+ACTION rwax::testcalc(
+    asset token,
+    uint64_t asset_id
+) {
+    assetpools_t asset_pools = get_assetpool(token.symbol.code().raw());
+
+    auto apool_itr = asset_pools.require_find(asset_id, "Asset not found");
+
+    asset tokens = apool_itr->issued_tokens;
+    
+    action(
+        permission_level{get_self(), name("active")},
+        get_self(),
+        name("logtest"),
+        make_tuple(
+            tokens
+        )
+    ).send();
+}
+
+ACTION rwax::logtest(
+    asset tokens
+) {
+    require_auth(get_self());
+}
+
+ACTION rwax::redeem(
+    name redeemer,
+    name contract,
+    asset quantity,
+    uint64_t asset_id,
+    symbol fee_currency
+) {
+    require_auth(redeemer);
+
+    redeem_assets(redeemer, contract, quantity, {asset_id}, fee_currency, true);
+}
+
+ACTION rwax::redeemnfts(
+    name redeemer,
+    name contract,
+    asset quantity,
+    vector<uint64_t> asset_ids,
+    symbol fee_currency
+) {
+    require_auth(redeemer);
+
+    check(asset_ids.size() > 0, "No assets to redeem");
+
+    redeem_assets(redeemer, contract, quantity, asset_ids, fee_currency, true);
+}
+
+// Redeems the cheapest pooled asset of the token, if it costs at most max_price
+ACTION rwax::redeemany(
+    name redeemer,
+    name contract,
+    asset max_price,
+    symbol fee_currency
+) {
+    require_auth(redeemer);
+
+    check_pools_indexed(max_price.symbol);
+
+    assetpools_t asset_pools = get_assetpool(max_price.symbol.code().raw());
+
+    auto pools_by_issued = asset_pools.get_index<name("issued")>();
+
+    auto apool_itr = pools_by_issued.begin();
+
+    check(apool_itr != pools_by_issued.end(), "No pooled assets");
+    check(apool_itr->issued_tokens.amount <= max_price.amount,
+        ("Cheapest asset costs " + apool_itr->issued_tokens.to_string()).c_str());
+
+    redeem_assets(redeemer, contract, apool_itr->issued_tokens, {apool_itr->asset_id}, fee_currency, true);
+}
+
+// Converts up to max_rows rows of one scope of a table to the layout of LAYOUT_VERSION, continuing from the
+// cursor kept in migrations. Returns the key to continue from, 0 when the scope is done. Once every scope
+// returned 0, endmigrate records the new layout.
+// - tokens, scope = token contract: registers the tokens in symbols and creates their descriptors
+// - assetpools, scope = token symbol code: adds missing issued index entries, stores collection, schema and
+//   template on the pools and builds the poolstats row. Needs the tokens of the symbol migrated first
+// - transfers, scope = 0: moves the legacy transfers rows into deposits, deposited now
+// Converted rows are paid by the contract.
+[[eosio::action]] uint64_t rwax::migrate(
+    name table,
+    uint64_t scope,
+    uint32_t max_rows
+) {
+    require_auth(get_self());
+
+    config_s current_config = config.get();
+
+    check(
+        !current_config.layout_version.has_value() || current_config.layout_version.value() < LAYOUT_VERSION,
+        "Tables are up to date"
+    );
+
+    migrations_t migrations = get_migrations(table);
+
+    auto migration_itr = migrations.find(scope);
+
+    migrations_s migration = {};
+    if (migration_itr != migrations.end()) {
+        migration = *migration_itr;
+    } else {
+        migration.scope = scope;
+        migration.cursor = 0;
+        migration.build_stats = table == name("assetpools") && poolstats.find(scope) == poolstats.end();
+        migration.pooled_assets = 0;
+        migration.issued_amount = 0;
+    }
+
+    bool done = false;
+
+    if (table == name("tokens")) {
+        done = migrate_tokens(name(scope), migration, max_rows);
+    } else if (table == name("assetpools")) {
+        auto symbol_itr = symbols.require_find(scope, "Token not registered. Migrate its tokens first");
+        done = migrate_pools(symbol_itr->token, migration, max_rows);
+    } else if (table == name("transfers")) {
+        done = migrate_transfers(migration, max_rows);
+    } else {
+        check(false, ("Nothing to migrate in " + table.to_string()).c_str());
+    }
+
+    if (done) {
+        if (migration_itr != migrations.end()) {
+            migrations.erase(migration_itr);
+        }
+        return 0;
+    }
+
+    if (migration_itr == migrations.end()) {
+        migrations.emplace(get_self(), [&](auto& new_migration) {
+            new_migration = migration;
+        });
+    } else {
+        migrations.modify(migration_itr, same_payer, [&](auto& modified_migration) {
+            modified_migration = migration;
+        });
+    }
+
+    return migration.cursor;
+}
+
+// Records that every table has been converted to LAYOUT_VERSION, after migrate returned 0 for every scope.
+// From then on tokenize and redeem no longer fall back to the old layout.
+ACTION rwax::endmigrate() {
+    require_auth(get_self());
+
+    for (name table : {name("tokens"), name("assetpools"), name("transfers")}) {
+        migrations_t migrations = get_migrations(table);
+        check(migrations.begin() == migrations.end(), ("Migration of " + table.to_string() + " not finished").c_str());
+    }
+
+    check(transfers.begin() == transfers.end(), "Legacy transfers not migrated");
+
+    config_s current_config = config.get();
+    current_config.layout_version.emplace(LAYOUT_VERSION);
+    config.set(current_config, get_self());
+}
+
+// Registers the tokens of a contract in symbols and copies the counters of their schemas from schemamap and
+// tokens into descriptors. Returns true when the last token is done.
+bool rwax::migrate_tokens(
+    name contract,
+    migrations_s& migration,
+    uint32_t max_rows
+) {
+    tokens_t tokens = get_tokens(contract);
+
+    auto token_itr = tokens.lower_bound(migration.cursor);
+
+    for (uint32_t i = 0; i < max_rows && token_itr != tokens.end(); i++, token_itr++) {
+        auto symbol_itr = symbols.find(token_itr->primary_key());
+        if (symbol_itr == symbols.end()) {
+            symbols.emplace(get_self(), [&](auto& new_symbol) {
+                new_symbol.token = token_itr->maximum_supply.symbol;
+                new_symbol.contract = contract;
+                new_symbol.collection_name = token_itr->collection_name;
+                new_symbol.schema_name = token_itr->schema_name;
+            });
+        } else {
+            // Tokens created before the registry could share a symbol across contracts. One has to be erased
+            // before the migration can go on, as a symbol must resolve to one token
+            check(symbol_itr->contract == contract, ("Duplicate symbol " + token_itr->maximum_supply.symbol.code().to_string()
+                + " issued by " + symbol_itr->contract.to_string() + " and " + contract.to_string()).c_str());
+        }
+
+        descriptors_t descriptors = get_descriptors(token_itr->collection_name);
+
+        descriptors_s descriptor = {};
+
+        if (descriptors.find(token_itr->schema_name.value) == descriptors.end()
+            && get_descriptor(token_itr->collection_name, token_itr->schema_name, descriptor)) {
+            descriptors.emplace(get_self(), [&](auto& new_descriptor) {
+                new_descriptor = descriptor;
+            });
+        }
+    }
+
+    if (token_itr != tokens.end()) {
+        migration.cursor = token_itr->primary_key();
+        return false;
+    }
+
+    return true;
+}
+
+// Brings the pools of a token to the current assetpools layout. Returns true when the last pool is done.
+// Pools without collection and schema get them from atomicassets and are erased and emplaced again, which
+// adds the issued index entry older pools miss. If they had no template_id either they are counted in
+// templatecaps as tokenize would have. Without a poolstats row, the pools are counted and the row is created at the end.
+bool rwax::migrate_pools(
+    symbol token,
+    migrations_s& migration,
+    uint32_t max_rows
+) {
+    assetpools_t asset_pools = get_assetpool(token.code().raw());
+
+    auto pools_by_issued = asset_pools.get_index<name("issued")>();
+
+    templatecaps_t templatecaps = get_templatecaps(token.code().raw());
+
+    assets_t pooled_assets = get_assets(get_self());
+
+    auto apool_itr = asset_pools.lower_bound(migration.cursor);
+
+    for (uint32_t i = 0; i < max_rows && apool_itr != asset_pools.end(); i++) {
+        assetpools_s pool = *apool_itr;
+
+        if (migration.build_stats) {
+            migration.pooled_assets++;
+            migration.issued_amount += pool.issued_tokens.amount;
+        }
+
+        // Pools are emplaced with collection and schema since after the issued index existed, so only pools
+        // without them can miss their index entry. Searching the index would cost every pool of the same amount
+        bool stored = pool.schema_name.has_value();
+
+        if (!stored) {
+            auto asset_itr = pooled_assets.require_find(pool.asset_id, ("Asset not found: " + to_string(pool.asset_id)).c_str());
+
+            if (!pool.template_id.has_value() && asset_itr->template_id > 0) {
+                auto cap_itr = templatecaps.find((uint64_t) asset_itr->template_id);
+                if (cap_itr == templatecaps.end()) {
+                    templatecaps.emplace(get_self(), [&](auto& new_cap) {
+                        new_cap.template_id = asset_itr->template_id;
+                        new_cap.max_assets_to_tokenize = NO_TEMPLATE_CAP;
+                        new_cap.currently_tokenized = 1;
+                    });
+                } else {
+                    templatecaps.modify(cap_itr, same_payer, [&](auto& modified_cap) {
+                        modified_cap.currently_tokenized = modified_cap.currently_tokenized + 1;
+                    });
+                }
+                pool.template_id.emplace(asset_itr->template_id);
+            }
+
+            // Extensions are serialized in order, so the ones before schema_name must be set as well
+            if (!pool.trait_keys.has_value()) {
+                pool.trait_keys.emplace(vector<uint64_t>{});
+            }
+            if (!pool.template_id.has_value()) {
+                pool.template_id.emplace(0);
+            }
+            pool.collection_name.emplace(asset_itr->collection_name);
+            pool.schema_name.emplace(asset_itr->schema_name);
+        }
+
+        if (!stored) {
+            // erase skips secondary entries that do not exist
+            asset_pools.erase(apool_itr);
+
+            asset_pools.emplace(get_self(), [&](auto& new_pool) {
+                new_pool = pool;
+            });
+        }
+
+        apool_itr = asset_pools.upper_bound(pool.asset_id);
+    }
+
+    if (apool_itr != asset_pools.end()) {
+        migration.cursor = apool_itr->asset_id;
+        return false;
+    }
+
+    if (migration.build_stats && poolstats.find(token.code().raw()) == poolstats.end()) {
+        poolstats.emplace(get_self(), [&](auto& new_stats) {
+            new_stats.pooled_assets = migration.pooled_assets;
+            new_stats.issued_tokens = asset(migration.issued_amount, token);
+            if (pools_by_issued.begin() != pools_by_issued.end()) {
+                new_stats.min_value = pools_by_issued.begin()->issued_tokens;
+                new_stats.max_value = (--pools_by_issued.end())->issued_tokens;
+            } else {
+                new_stats.min_value = asset(0, token);
+                new_stats.max_value = asset(0, token);
+            }
+        });
+    }
+
+    return true;
+}
+
+// Moves the legacy transfers rows into deposits. They have no deposit time, so they are stamped with the time
+// of the migration and expire DEPOSIT_EXPIRY_SECONDS later. Returns true when the last row is done.
+bool rwax::migrate_transfers(
+    migrations_s& migration,
+    uint32_t max_rows
+) {
+    time_point_sec now = time_point_sec(current_time_point());
+
+    auto transfer_itr = transfers.lower_bound(migration.cursor);
+
+    for (uint32_t i = 0; i < max_rows && transfer_itr != transfers.end(); i++) {
+        if (transfer_itr->assets.size() > 0) {
+            add_deposit(transfer_itr->user, transfer_itr->assets, now);
+        }
+        transfer_itr = transfers.erase(transfer_itr);
+    }
+
+    if (transfer_itr != transfers.end()) {
+        migration.cursor = transfer_itr->user.value;
+        return false;
+    }
+
+    return true;
+}
+
+// Tokens whose poolstats row migrate is still building: changes to pools the migration has already counted
+// go to its running totals, the others are counted when the migration gets to them.
+void rwax::count_migrating_pool(
+    symbol token,
+    uint64_t asset_id,
+    int32_t count,
+    int64_t amount
+) {
+    if (is_migrated()) {
+        return;
+    }
+
+    migrations_t migrations = get_migrations(name("assetpools"));
+
+    auto migration_itr = migrations.find(token.code().raw());
+
+    if (migration_itr == migrations.end() || !migration_itr->build_stats || asset_id >= migration_itr->cursor) {
+        return;
+    }
+
+    migrations.modify(migration_itr, same_payer, [&](auto& modified_migration) {
+        modified_migration.pooled_assets = modified_migration.pooled_assets + count;
+        modified_migration.issued_amount = modified_migration.issued_amount + amount;
+    });
 }
 
-ACTION rwax::settokenfee(
-    asset fees
+// Descriptor of a tokenized schema. Schemas tokenized before descriptors are read from their schemamap
+// and tokens rows. Returns false if the schema has no token.
+bool rwax::get_descriptor(
+    name collection_name,
+    name schema_name,
+    descriptors_s& descriptor
 ) {
-    require_auth(get_self());
-    config_s current_config = config.get();
-    current_config.tokenize_fees = fees;
-    config.set(current_config, get_self());
+    descriptors_t descriptors = get_descriptors(collection_name);
+
+    descriptors_t::const_iterator descriptor_itr = descriptors.end();
+
+    return get_descriptor(descriptors, collection_name, schema_name, descriptor_itr, descriptor);
 }
 
-ACTION rwax::setredeemfee(
-    asset fees
+// Same, also returning the row in descriptors for add_tokenized (descriptors.end() for schemas not yet migrated),
+// so tokenize and redeem read the descriptor once
+bool rwax::get_descriptor(
+    descriptors_t& descriptors,
+    name collection_name,
+    name schema_name,
+    descriptors_t::const_iterator& descriptor_itr,
+    descriptors_s& descriptor
 ) {
-    require_auth(get_self());
-    config_s current_config = config.get();
-    current_config.redeem_fees = fees;
-    config.set(current_config, get_self());
+    descriptor_itr = descriptors.find(schema_name.value);
+    if (descriptor_itr != descriptors.end()) {
+        descriptor = *descriptor_itr;
+        return true;
+    }
+
+    if (is_migrated()) {
+        return false;
+    }
+
+    schemamap_t schemamap = get_schemamap(collection_name);
+
+    auto schemamap_itr = schemamap.find(schema_name.value);
+    if (schemamap_itr == schemamap.end()) {
+        return false;
+    }
+
+    tokens_t tokens = get_tokens(schemamap_itr->contract);
+
+    auto token_itr = tokens.find(schemamap_itr->token.symbol.code().raw());
+    if (token_itr == tokens.end()) {
+        return false;
+    }
+
+    descriptor.schema_name = schema_name;
+    descriptor.maximum_supply = token_itr->maximum_supply;
+    descriptor.issued_supply = token_itr->issued_supply;
+    descriptor.contract = schemamap_itr->contract;
+    descriptor.authorized_account = token_itr->authorized_account;
+    descriptor.max_assets_to_tokenize = schemamap_itr->max_assets_to_tokenize;
+    descriptor.currently_tokenized = schemamap_itr->currently_tokenized;
+    descriptor.issue_divisor = token_itr->max_assets_to_tokenize;
+
+    return true;
 }
 
-[[eosio::action, eosio::read_only]] asset rwax::calctokens(
-    uint64_t asset_id,
-    name owner
+// Adds count assets and their issued tokens (both negative on redeem) to the counters of a tokenized
+// schema: the descriptor_itr row, or schemamap and tokens for schemas not yet migrated.
+void rwax::add_tokenized(
+    descriptors_t& descriptors,
+    descriptors_t::const_iterator descriptor_itr,
+    name collection_name,
+    name schema_name,
+    int32_t count,
+    asset issued_tokens
 ) {
-    assets_t my_assets = get_assets(owner);
+    if (descriptor_itr != descriptors.end()) {
+        descriptors.modify(descriptor_itr, same_payer, [&](auto& modified_descriptor) {
+            modified_descriptor.currently_tokenized = modified_descriptor.currently_tokenized + count;
+            modified_descriptor.issued_supply = modified_descriptor.issued_supply + issued_tokens;
+        });
+        return;
+    }
 
-    auto asset_itr = my_assets.require_find(asset_id, "Asset not found");
+    schemamap_t schemamap = get_schemamap(collection_name);
 
-    return calculate_issued_tokens(owner, asset_id);
+    auto schemamap_itr = schemamap.require_find(schema_name.value, "Schema not found");
+
+    schemamap.modify(schemamap_itr, same_payer, [&](auto& modified_item) {
+        modified_item.currently_tokenized = modified_item.currently_tokenized + count;
+    });
+
+    tokens_t tokens = get_tokens(schemamap_itr->contract);
+
+    auto token_itr = tokens.require_find(issued_tokens.symbol.code().raw(), "Token not found");
+
+    tokens.modify(token_itr, same_payer, [&](auto& modified_item) {
+        modified_item.issued_supply = modified_item.issued_supply + issued_tokens;
+    });
 }
 
-[[eosio::action, eosio::read_only]] asset rwax::redeemamount(
-    asset token,
-    uint64_t asset_id
+// True once endmigrate recorded the current layout, so there are no rows of the old layout left to read
+bool rwax::is_migrated() {
+    if (!config.exists()) {
+        return false;
+    }
+
+    config_s current_config = config.get();
+
+    return current_config.layout_version.has_value() && current_config.layout_version.value() >= LAYOUT_VERSION;
+}
+
+// The issued index misses pools tokenized before it existed until migrate adds them. A token has all its
+// pools indexed once it has a poolstats row (created with the token, or at the end of its migration) and no
+// migration of its pools is in progress.
+void rwax::check_pools_indexed(
+    symbol token
 ) {
-    assetpools_t asset_pools = get_assetpool(token.symbol.code().raw());
+    if (is_migrated()) {
+        return;
+    }
 
-    auto apool_itr = asset_pools.require_find(asset_id, "Asset not found");
+    migrations_t migrations = get_migrations(name("assetpools"));
 
-    return apool_itr->issued_tokens;    
+    check(
+        poolstats.find(token.code().raw()) != poolstats.end() && migrations.find(token.code().raw()) == migrations.end(),
+        ("Pools of " + token.code().to_string() + " are not migrated yet").c_str()
+    );
 }
 
-ACTION rwax::testcalc(
-    asset token,
-    uint64_t asset_id
+// Contract of a token from the symbols registry. Tokens created before the registry are found through
+// the schemamap row of the pooled asset.
+name rwax::get_token_contract(
+    const assetpools_s& pool,
+    symbol token
 ) {
-    assetpools_t asset_pools = get_assetpool(token.symbol.code().raw());
+    auto symbol_itr = symbols.find(token.code().raw());
+    if (symbol_itr != symbols.end()) {
+        return symbol_itr->contract;
+    }
 
-    auto apool_itr = asset_pools.require_find(asset_id, "Asset not found");
+    check(!is_migrated(), "Token not registered");
 
-    asset tokens = apool_itr->issued_tokens;
-    
-    action(
-        permission_level{get_self(), name("active")},
-        get_self(),
-        name("logtest"),
-        make_tuple(
-            tokens
-        )
-    ).send();
+    auto [collection_name, schema_name] = get_pool_schema(pool);
+
+    schemamap_t schemamap = get_schemamap(collection_name);
+
+    auto schemamap_itr = schemamap.require_find(schema_name.value, "Schema not found");
+
+    return schemamap_itr->contract;
 }
 
-ACTION rwax::logtest(
-    asset tokens
+// Collection and schema of a pooled asset. Pools not yet converted by migrate are looked up in atomicassets.
+pair<name, name> rwax::get_pool_schema(
+    const assetpools_s& pool
 ) {
-    require_auth(get_self());
+    if (pool.schema_name.has_value()) {
+        return {pool.collection_name.value(), pool.schema_name.value()};
+    }
+
+    check(!is_migrated(), ("Pool not migrated: " + to_string(pool.asset_id)).c_str());
+
+    assets_t pooled_assets = get_assets(get_self());
+
+    auto asset_itr = pooled_assets.require_find(pool.asset_id, ("Asset not found: " + to_string(pool.asset_id)).c_str());
+
+    return {asset_itr->collection_name, asset_itr->schema_name};
 }
 
-ACTION rwax::redeem(
+// Redeems the pooled assets for exactly the sum of their issued tokens, withdrawn from the redeemer's
+// balance at once. Schema and template counters are updated once per schema / template, and all
+// assets go out in one atomicassets transfer.
+// Without from_balance, quantity was just transferred in with a redeem:<asset_ids> memo and never credited.
+void rwax::redeem_assets(
     name redeemer,
     name contract,
     asset quantity,
-    uint64_t asset_id,
-    symbol fee_currency
+    vector<uint64_t> asset_ids,
+    symbol fee_currency,
+    bool from_balance
 ) {
-    require_auth(redeemer);
+    check(quantity.amount > 0, "Must redeem positive amount");
 
-    auto balance_itr = balances.require_find(redeemer.value, "No balance object found");
+    if (from_balance) {
+        vector<TOKEN_BALANCE> assets = {};
+        TOKEN_BALANCE balance = {};
+        balance.contract = contract;
+        balance.quantity = quantity;
 
-    check(quantity.amount > 0, "Must redeem positive amount");
+        assets.push_back(balance);
 
-    vector<TOKEN_BALANCE> assets = {};
-    TOKEN_BALANCE balance = {};
-    balance.contract = contract;
-    balance.quantity = quantity;
+        withdraw_balances(redeemer, assets);
+    }
 
-    assets.push_back(balance);
+    // The descriptor of the token's schema holds the fee recipient and the counters its pools go back to
+    name collection_name;
+    name schema_name;
 
-    withdraw_balances(redeemer, assets);
+    auto symbol_itr = symbols.find(quantity.symbol.code().raw());
+    if (symbol_itr != symbols.end()) {
+        check(symbol_itr->contract == contract, "Token not found");
+        collection_name = symbol_itr->collection_name;
+        schema_name = symbol_itr->schema_name;
+    } else {
+        check(!is_migrated(), "Token not found");
 
-    tokens_t tokens = get_tokens(contract);
+        tokens_t tokens = get_tokens(contract);
 
-    auto token_itr = tokens.require_find(quantity.symbol.code().raw(), "Token not found");
+        auto token_itr = tokens.require_find(quantity.symbol.code().raw(), "Token not found");
+        collection_name = token_itr->collection_name;
+        schema_name = token_itr->schema_name;
+    }
 
-    config_s current_config = config.get();
-    asset fees = current_config.redeem_fees;
-    
-    auto feetoken_itr = feetokens.require_find(fee_currency.code().raw(), "Fee token not found");
-    float fee_amount = fees.amount / 100000000;
+    descriptors_t descriptors = get_descriptors(collection_name);
+    descriptors_t::const_iterator descriptor_itr = descriptors.end();
 
-    asset fee_asset = fee_amount * feetoken_itr->fee;
+    descriptors_s descriptor = {};
 
-    if (fee_asset.amount > 0) {
-        vector<TOKEN_BALANCE> collection_shares = {};
-        TOKEN_BALANCE collection_share = {};
-        collection_share.quantity = fee_asset * 0.8;
-        collection_share.contract = feetoken_itr->contract;;
-        collection_shares.push_back(collection_share);
-        vector<TOKEN_BALANCE> service_shares = {};
-        TOKEN_BALANCE service_share = {};
-        service_share.quantity = fee_asset * 0.2;
-        service_share.contract = feetoken_itr->contract;;
-        service_shares.push_back(service_share);
-        withdraw_balances(redeemer, service_shares);
-        withdraw_balances(redeemer, collection_shares);
-        add_balances(token_itr->authorized_account, collection_shares);
-        add_balances(get_self(), service_shares);
-    }
+    check(
+        get_descriptor(descriptors, collection_name, schema_name, descriptor_itr, descriptor)
+            && descriptor.maximum_supply.symbol == quantity.symbol,
+        "Token not found"
+    );
+
+    config_s current_config = config.get();
 
-    asset issued_supply = token_itr->issued_supply;
+    FEE_SHARES fee_shares = {};
+    for (size_t i = 0; i < asset_ids.size(); i++) {
+        add_fee_shares(fee_shares, current_config.redeem_fees, fee_currency, descriptor.authorized_account);
+    }
+    settle_fees(redeemer, fee_shares);
 
     assetpools_t asset_pools = get_assetpool(quantity.symbol.code().raw());
 
-    bool matched = false;
+    map<pair<name, name>, pair<int32_t, int64_t>> schema_totals = {}; //assets and issued amount per schema
+    map<int32_t, uint32_t> template_counts = {};
 
-    auto apool_itr = asset_pools.require_find(asset_id, "Asset not found");
+    asset issued_tokens = asset(0, quantity.symbol);
 
-    assets_t asset_pool_assets = get_assets(get_self());
+    bool has_stats = poolstats.find(quantity.symbol.code().raw()) != poolstats.end();
 
-    auto asset_itr = asset_pool_assets.require_find(apool_itr->asset_id);
+    for (uint64_t asset_id : asset_ids) {
+        auto apool_itr = asset_pools.require_find(asset_id, ("Asset not found: " + to_string(asset_id)).c_str());
 
-    schemamap_t schemamap = get_schemamap(asset_itr->collection_name);
+        auto& schema_total = schema_totals[get_pool_schema(*apool_itr)];
+        schema_total.first++;
+        schema_total.second += apool_itr->issued_tokens.amount;
 
-    auto schemamap_itr = schemamap.find(asset_itr->schema_name.value);
+        issued_tokens += apool_itr->issued_tokens;
 
-    schemamap.modify(schemamap_itr, same_payer, [&](auto& modified_item) {
-        modified_item.currently_tokenized = modified_item.currently_tokenized - 1;
-    });
+        if (apool_itr->trait_keys.has_value()) {
+            remove_trait_counts(quantity.symbol, apool_itr->trait_keys.value());
+        }
+
+        // Pools created before template counters existed are not counted until migrate
+        if (apool_itr->template_id.has_value()) {
+            template_counts[apool_itr->template_id.value()]++;
+        }
 
-    asset issued_tokens = apool_itr->issued_tokens;
+        if (!has_stats) {
+            count_migrating_pool(quantity.symbol, apool_itr->asset_id, -1, -apool_itr->issued_tokens.amount);
+        }
+
+        asset_pools.erase(apool_itr);
+    }
 
     check(issued_tokens.amount == quantity.amount, ("Must transfer exactly " + issued_tokens.to_string()).c_str());
 
-    asset_pools.erase(apool_itr);
+    for (auto& [schema, total] : schema_totals) {
+        asset schema_issued = asset(-total.second, quantity.symbol);
 
-    vector<uint64_t> asset_ids = {};
-    asset_ids.push_back(asset_itr->asset_id);
+        if (schema.first == collection_name && schema.second == schema_name) {
+            add_tokenized(descriptors, descriptor_itr, schema.first, schema.second, -total.first, schema_issued);
+            continue;
+        }
+
+        // initschemas can map more schemas to the same token
+        descriptors_t schema_descriptors = get_descriptors(schema.first);
+        add_tokenized(
+            schema_descriptors, schema_descriptors.find(schema.second.value), schema.first, schema.second, -total.first, schema_issued);
+    }
+
+    templatecaps_t templatecaps = get_templatecaps(quantity.symbol.code().raw());
+
+    for (auto& [template_id, count] : template_counts) {
+        auto cap_itr = templatecaps.find((uint64_t) template_id);
+        if (cap_itr != templatecaps.end()) {
+            templatecaps.modify(cap_itr, same_payer, [&](auto& modified_cap) {
+                modified_cap.currently_tokenized = modified_cap.currently_tokenized > count
+                    ? modified_cap.currently_tokenized - count : 0;
+            });
+        }
+    }
 
     action(
         permission_level{get_self(), name("active")},
@@ -921,9 +2305,23 @@ ACTION rwax::redeem(
         )
     ).send();
 
-    tokens.modify(token_itr, same_payer, [&](auto& modified_item) {
-        modified_item.issued_supply = modified_item.issued_supply - issued_tokens;
-    });
+    auto stats_itr = poolstats.find(quantity.symbol.code().raw());
+    if (stats_itr != poolstats.end()) {
+        auto pools_by_issued = asset_pools.get_index<name("issued")>();
+
+        poolstats.modify(stats_itr, same_payer, [&](auto& modified_stats) {
+            modified_stats.pooled_assets = modified_stats.pooled_assets > asset_ids.size()
+                ? modified_stats.pooled_assets - asset_ids.size() : 0;
+            modified_stats.issued_tokens = modified_stats.issued_tokens - issued_tokens;
+            if (pools_by_issued.begin() != pools_by_issued.end()) {
+                modified_stats.min_value = pools_by_issued.begin()->issued_tokens;
+                modified_stats.max_value = (--pools_by_issued.end())->issued_tokens;
+            } else {
+                modified_stats.min_value = asset(0, quantity.symbol);
+                modified_stats.max_value = asset(0, quantity.symbol);
+            }
+        });
+    }
 }
 
 ACTION rwax::withdraw(
@@ -1007,6 +2405,91 @@ void rwax::withdraw_balances(name account, vector<TOKEN_BALANCE> tokens) {
     }    
 }
 
+// Adds the fee for one asset, split 80/20 between the collection and the contract
+void rwax::add_fee_shares(
+    FEE_SHARES& fee_shares,
+    asset fees,
+    symbol fee_currency,
+    name collection_account
+) {
+    auto feetoken_itr = feetokens.require_find(fee_currency.code().raw(), "Fee token not found");
+    float fee_amount = fees.amount / 100000000;
+
+    asset fee_asset = fee_amount * feetoken_itr->fee;
+
+    if (fee_asset.amount > 0) {
+        TOKEN_BALANCE collection_share = {};
+        collection_share.quantity = fee_asset * 0.8;
+        collection_share.contract = feetoken_itr->contract;
+        add_fee_share(fee_shares, collection_account, collection_share);
+        TOKEN_BALANCE service_share = {};
+        service_share.quantity = fee_asset * 0.2;
+        service_share.contract = feetoken_itr->contract;
+        add_fee_share(fee_shares, get_self(), service_share);
+    }
+}
+
+void rwax::add_fee_share(
+    FEE_SHARES& fee_shares,
+    name recipient,
+    TOKEN_BALANCE share
+) {
+    vector<TOKEN_BALANCE>& shares = fee_shares[recipient];
+    for (TOKEN_BALANCE& existing_share : shares) {
+        if (existing_share.contract == share.contract && existing_share.quantity.symbol == share.quantity.symbol) {
+            existing_share.quantity += share.quantity;
+            return;
+        }
+    }
+    shares.push_back(share);
+}
+
+// Sum of the shares of all recipients, per token
+vector<TOKEN_BALANCE> rwax::get_fee_totals(
+    FEE_SHARES fee_shares
+) {
+    FEE_SHARES totals = {};
+    for (auto& [recipient, shares] : fee_shares) {
+        for (TOKEN_BALANCE share : shares) {
+            add_fee_share(totals, name(), share);
+        }
+    }
+
+    return totals[name()];
+}
+
+// One withdrawal from the payer for the sum of all shares, then one credit per recipient
+void rwax::settle_fees(
+    name payer,
+    FEE_SHARES fee_shares
+) {
+    if (fee_shares.size() == 0) {
+        return;
+    }
+
+    vector<TOKEN_BALANCE> fee_totals = get_fee_totals(fee_shares);
+
+    // Checked up front, withdraw_balances would only report a missing balance without naming the fee
+    auto balance_itr = balances.find(payer.value);
+    for (TOKEN_BALANCE fee : fee_totals) {
+        bool covered = false;
+        if (balance_itr != balances.end()) {
+            for (TOKEN_BALANCE balance : balance_itr->assets) {
+                if (balance.contract == fee.contract && balance.quantity.symbol == fee.quantity.symbol) {
+                    covered = balance.quantity.amount >= fee.quantity.amount;
+                }
+            }
+        }
+        check(covered, "Balance does not cover the fee of " + fee.quantity.to_string() + ". Top it up first");
+    }
+
+    withdraw_balances(payer, fee_totals);
+
+    for (auto& [recipient, shares] : fee_shares) {
+        add_balances(recipient, shares);
+    }
+}
+
 void rwax::add_balances(name account, vector<TOKEN_BALANCE> tokens) {
     auto balance_itr = balances.find(account.value);
 
@@ -1034,50 +2517,135 @@ void rwax::add_balances(name account, vector<TOKEN_BALANCE> tokens) {
     }
 }
 
+// Parses the memo in one pass: the keyword before ':' selects the type, the rest are its arguments.
+// Unknown keywords give MEMO_TYPE::NONE, malformed redeem ids or fee symbols fail.
+// Only redeem and tokenize read arguments, the other keywords ignore anything after ':'.
+MEMO rwax::parse_memo(
+    const string& memo
+) {
+    MEMO parsed_memo = {};
+    parsed_memo.type = MEMO_TYPE::NONE;
+
+    size_t separator = memo.find(':');
+    string keyword = memo.substr(0, separator);
+    bool has_arguments = separator != string::npos;
+
+    switch (keyword.size()) {
+        case 3:
+            if (keyword == "buy") parsed_memo.type = MEMO_TYPE::BUY;
+            break;
+        case 5:
+            if (keyword == "topup") parsed_memo.type = MEMO_TYPE::TOPUP;
+            break;
+        case 6:
+            if (keyword == "redeem") parsed_memo.type = MEMO_TYPE::REDEEM;
+            else if (keyword == "payfee") parsed_memo.type = MEMO_TYPE::PAYFEE;
+            break;
+        case 7:
+            if (keyword == "deposit") parsed_memo.type = MEMO_TYPE::DEPOSIT;
+            break;
+        case 8:
+            if (keyword == "tokenize") parsed_memo.type = MEMO_TYPE::TOKENIZE;
+            break;
+    }
+
+    // deposit:<anything>, buy:<anything> and the like keep working as they did before arguments were parsed
+    if (!has_arguments || (parsed_memo.type != MEMO_TYPE::REDEEM && parsed_memo.type != MEMO_TYPE::TOKENIZE)) {
+        return parsed_memo;
+    }
+
+    string arguments = memo.substr(separator + 1);
+
+    if (parsed_memo.type == MEMO_TYPE::REDEEM) {
+        size_t fee_separator = arguments.find(':');
+        if (fee_separator != string::npos) {
+            parsed_memo.fee_currency = symbol_code(arguments.substr(fee_separator + 1));
+            arguments = arguments.substr(0, fee_separator);
+        }
+
+        uint64_t asset_id = 0;
+        bool has_digits = false;
+        for (char c : arguments) {
+            if (c == ',') {
+                check(has_digits, "Invalid Memo. Expected redeem:<asset_id>[,<asset_id>][:<fee symbol>]");
+                parsed_memo.asset_ids.push_back(asset_id);
+                asset_id = 0;
+                has_digits = false;
+            } else {
+                check(c >= '0' && c <= '9', "Invalid Memo. Expected redeem:<asset_id>[,<asset_id>][:<fee symbol>]");
+                asset_id = asset_id * 10 + (c - '0');
+                has_digits = true;
+            }
+        }
+        check(has_digits, "Invalid Memo. Expected redeem:<asset_id>[,<asset_id>][:<fee symbol>]");
+        parsed_memo.asset_ids.push_back(asset_id);
+    } else if (parsed_memo.type == MEMO_TYPE::TOKENIZE) {
+        parsed_memo.fee_currency = symbol_code(arguments);
+    }
+
+    return parsed_memo;
+}
+
 void rwax::receive_transfer(
     name from,
     name to,
     asset quantity,
     string memo
 ) {
-    name contract = get_first_receiver();
-
-    check(quantity.amount > 0, "Must transfer positive amount");
-    
-    if (to != get_self() || (memo != "redeem" && memo != "payfee" && memo != "topup" && memo != "buy" && memo != "deposit")) {
+    if (to != get_self()) {
         return;
     }
 
-    if (memo != "deposit") {
-        check(is_token_supported(contract, quantity.symbol), "Token not supported");
-    }
+    MEMO parsed_memo = parse_memo(memo);
 
-    if (memo == "buy") {
-        check(contract == CORE_TOKEN_CONTRACT, "Must buy with WAX");
+    if (parsed_memo.type == MEMO_TYPE::NONE || parsed_memo.type == MEMO_TYPE::TOKENIZE) {
+        return;
     }
 
-    if (memo == "topup") {
-        check(contract == RWAX_TOKEN_CONTRACT, "Must top up RWAX balance");
-    }
+    name contract = get_first_receiver();
 
-    if (memo == "deposit") {
-        check(contract == from, ("Not authorized to use this token: " + contract.to_string()).c_str());
-        check(contract != RWAX_TOKEN_CONTRACT, "Must deposit custom token");
-    }
+    check(quantity.amount > 0, "Must transfer positive amount");
 
-    if (memo == "payfee") {
-        auto token_itr = feetokens.require_find(quantity.symbol.code().raw(), "Fee currency is not supported");
+    switch (parsed_memo.type) {
+        case MEMO_TYPE::BUY:
+            check(is_token_supported(contract, quantity.symbol), "Token not supported");
+            check(contract == CORE_TOKEN_CONTRACT, "Must buy with WAX");
+            break;
+        case MEMO_TYPE::TOPUP:
+            check(is_token_supported(contract, quantity.symbol), "Token not supported");
+            check(contract == RWAX_TOKEN_CONTRACT, "Must top up RWAX balance");
+            break;
+        case MEMO_TYPE::DEPOSIT:
+            check(contract == from, ("Not authorized to use this token: " + contract.to_string()).c_str());
+            check(contract != RWAX_TOKEN_CONTRACT, "Must deposit custom token");
+            break;
+        case MEMO_TYPE::PAYFEE:
+            check(is_token_supported(contract, quantity.symbol), "Token not supported");
+            feetokens.require_find(quantity.symbol.code().raw(), "Fee currency is not supported");
+            break;
+        default:
+            check(is_token_supported(contract, quantity.symbol), "Token not supported");
+            break;
     }
 
-    if (memo == "redeem" || memo == "payfee" || memo == "buy" || memo == "topup" || memo == "deposit") {
-        name account = from;
-        vector<TOKEN_BALANCE> tokens = {};
-        TOKEN_BALANCE new_balance = {};
-        new_balance.quantity = quantity;
-        new_balance.contract = contract;
-        tokens.push_back(new_balance);
-        add_balances(account, tokens);
+    // redeem:<asset_ids>[:<fee symbol>] redeems right away, the tokens never go to the balance.
+    // Fees are paid from the balance in the given fee token, RWAX by default
+    if (parsed_memo.type == MEMO_TYPE::REDEEM && parsed_memo.asset_ids.size() > 0) {
+        symbol fee_currency = FEE_SYMBOL;
+        if (parsed_memo.fee_currency.raw() != 0) {
+            fee_currency = feetokens.require_find(parsed_memo.fee_currency.raw(), "Fee token not found")->fee.symbol;
+        }
+        redeem_assets(from, contract, quantity, parsed_memo.asset_ids, fee_currency, false);
+        return;
     }
+
+    name account = from;
+    vector<TOKEN_BALANCE> tokens = {};
+    TOKEN_BALANCE new_balance = {};
+    new_balance.quantity = quantity;
+    new_balance.contract = contract;
+    tokens.push_back(new_balance);
+    add_balances(account, tokens);
 }
 
 void rwax::receive_asset_transfer(
@@ -1090,31 +2658,30 @@ void rwax::receive_asset_transfer(
         return;
     }
 
-    check(memo.find("deposit") == 0, "Invalid Memo.");
+    MEMO parsed_memo = parse_memo(memo);
 
-    vector<uint64_t> assets_to_add = {};
-    for (uint64_t asset_id : asset_ids) {
-        assets_to_add.push_back(asset_id);
-    }
+    // tokenize:<fee symbol> tokenizes the assets right away instead of keeping them for tokenizenfts.
+    // A notification cannot bill RAM to the sender, so the contract pays for the new rows. Pool rows are
+    // bounded by the schema's max_assets_to_tokenize, like any tokenization
+    if (parsed_memo.type == MEMO_TYPE::TOKENIZE) {
+        auto feetoken_itr = feetokens.require_find(parsed_memo.fee_currency.raw(), "Fee token not found");
 
-    auto transfer_itr = transfers.find(from.value);
-    if (transfer_itr == transfers.end()) {
-        transfers.emplace(get_self(), [&](auto& _transfer) {
-            _transfer.user = from;
-            _transfer.assets = assets_to_add;
-        });
-    } else {
-        transfers.modify(transfer_itr, get_self(), [&](auto& modified_transfer) {
-            vector<uint64_t> A = modified_transfer.assets;
-            struct {
-                bool operator()(uint64_t a, uint64_t b) const { return a < b; }
-            } sorter;
-            std::sort(assets_to_add.begin(), assets_to_add.end(), sorter);
-            std::sort(A.begin(), A.end(), sorter);
-            vector<uint64_t> AB(assets_to_add.size() + A.size());
-            vector<uint64_t>::iterator it = set_union(A.begin(), A.end(), assets_to_add.begin(), assets_to_add.end(), AB.begin());
-            AB.resize(it-AB.begin());
-            modified_transfer.assets = AB;
-        });
+        FEE_SHARES fee_shares = {};
+
+        vector<TOKENIZE_RECORD> records = {};
+        for (uint64_t asset_id : asset_ids) {
+            records.push_back(tokenize_asset(asset_id, from, feetoken_itr->fee.symbol, get_self(), fee_shares));
+        }
+
+        settle_fees(from, fee_shares);
+
+        log_tokenizes(from, records);
+
+        return;
     }
+
+    check(memo.find("deposit") == 0, "Invalid Memo.");
+
+    // Every deposit gets its own rows, so it never rewrites earlier pending rows
+    add_deposit(from, asset_ids, time_point_sec(current_time_point()));
 }
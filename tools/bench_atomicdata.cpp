@@ -0,0 +1,401 @@
+// Microbenchmark for include/atomicdata.hpp, to measure changes to the serialization code.
+//
+// usage: rwax-bench-atomicdata [--blobs N] [--min-time SECONDS] [--dump-schemas schemas.json]
+//
+// Builds a corpus of synthetic blobs for a few representative schemas and reports ns per attribute and
+// heap allocations per blob for serialize and deserialize, and ns / allocations per call for the base58
+// coding of ipfs attributes. Allocations are counted by replacing the global operator new.
+//
+// --dump-schemas writes the corpus schemas in the rwax-schemagen input format. Configuring the tools with
+// -DRWAX_SCHEMAS=<that file> adds the generated decoders to the benchmark.
+// New decoding or encoding variants (projected, lazy, ...) are added as rows of VARIANTS in main.
+
+#include <functional>
+#include <new>
+#include <random>
+
+#include "common.hpp"
+
+using namespace tools;
+
+static size_t allocation_count = 0;
+
+// The replacements below allocate with malloc and release with free. Both go through these two functions,
+// kept out of line so GCC does not pair an inlined operator new with free (-Wmismatched-new-delete).
+// Every form of operator new and delete is replaced, so no allocation reaches the library's own.
+[[gnu::noinline]] static void *allocate(size_t size, size_t alignment) {
+    allocation_count++;
+    size = size > 0 ? size : 1;
+    void *ptr = alignment > alignof(std::max_align_t)
+        ? std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)
+        : std::malloc(size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+[[gnu::noinline]] static void release(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void *operator new(size_t size) {
+    return allocate(size, 0);
+}
+
+void *operator new[](size_t size) {
+    return allocate(size, 0);
+}
+
+void *operator new(size_t size, std::align_val_t alignment) {
+    return allocate(size, static_cast<size_t>(alignment));
+}
+
+void *operator new[](size_t size, std::align_val_t alignment) {
+    return allocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void *ptr) noexcept {
+    release(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    release(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    release(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept {
+    release(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept {
+    release(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t) noexcept {
+    release(ptr);
+}
+
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept {
+    release(ptr);
+}
+
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept {
+    release(ptr);
+}
+
+//Written by every measured operation so the compiler cannot drop the work
+static volatile uint64_t sink = 0;
+
+// One attribute of a corpus schema. length is the string length, or the element count of an array
+struct FIELD_SPEC {
+    string name;
+    string type;
+    size_t length;
+};
+
+struct SCHEMA_SPEC {
+    string schema_name;
+    vector <FIELD_SPEC> fields;
+};
+
+static const string COLLECTION_NAME = "benchmark";
+
+static const vector <SCHEMA_SPEC> CORPUS = {
+    {"gameitem", {
+        {"name", "string", 16},
+        {"rarity", "string", 6},
+        {"level", "uint8", 0},
+        {"power", "uint16", 0},
+        {"durability", "uint32", 0},
+        {"tradeable", "bool", 0},
+        {"img", "image", 46}
+    }},
+    {"artdrop", {
+        {"name", "string", 24},
+        {"artist", "string", 12},
+        {"description", "string", 280},
+        {"img", "image", 46},
+        {"backimg", "image", 46},
+        {"video", "image", 46},
+        {"edition", "uint32", 0},
+        {"max_edition", "uint32", 0}
+    }},
+    {"rpgitem", {
+        {"name", "string", 20},
+        {"class", "string", 8},
+        {"level", "uint16", 0},
+        {"stats", "uint32[]", 8},
+        {"resistances", "int16[]", 6},
+        {"modifiers", "float[]", 4},
+        {"tags", "string[]", 3},
+        {"weight", "double", 0}
+    }},
+    {"ipfsitem", {
+        {"name", "string", 16},
+        {"img", "ipfs", 0},
+        {"video", "ipfs", 0},
+        {"model", "ipfs", 0},
+        {"thumbnail", "ipfs", 0},
+        {"metadata", "ipfs", 0},
+        {"version", "uint8", 0}
+    }}
+};
+
+// Base58 text of a random sha256 multihash, like an ipfs CIDv0 ("Qm...")
+static string random_ipfs(std::mt19937_64 &rng) {
+    vector <uint8_t> multihash = {0x12, 0x20};
+    for (int i = 0; i < 32; i++) {
+        multihash.push_back((uint8_t) rng());
+    }
+    return EncodeBase58(multihash);
+}
+
+static string random_text(std::mt19937_64 &rng, size_t length) {
+    static const string letters = "abcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    string text(length, ' ');
+    for (char &c : text) {
+        c = letters[rng() % letters.size()];
+    }
+    return text;
+}
+
+template <typename T>
+static vector <T> random_vector(std::mt19937_64 &rng, size_t length, uint64_t range) {
+    vector <T> vec = {};
+    for (size_t i = 0; i < length; i++) {
+        vec.push_back((T) (rng() % range));
+    }
+    return vec;
+}
+
+static ATOMIC_ATTRIBUTE random_attribute(std::mt19937_64 &rng, const FIELD_SPEC &field) {
+    const string &type = field.type;
+    if (type == "string" || type == "image") {
+        return random_text(rng, field.length);
+    } else if (type == "ipfs") {
+        return random_ipfs(rng);
+    } else if (type == "bool") {
+        return (uint8_t) (rng() % 2);
+    } else if (type == "uint8") {
+        return (uint8_t) (rng() % 100);
+    } else if (type == "uint16") {
+        return (uint16_t) (rng() % 10000);
+    } else if (type == "uint32") {
+        return (uint32_t) (rng() % 1000000);
+    } else if (type == "double") {
+        return (double) (rng() % 100000) / 100;
+    } else if (type == "uint32[]") {
+        return random_vector <uint32_t>(rng, field.length, 1000);
+    } else if (type == "int16[]") {
+        INT16_VEC vec = random_vector <int16_t>(rng, field.length, 200);
+        for (int16_t &value : vec) {
+            value -= 100;
+        }
+        return vec;
+    } else if (type == "float[]") {
+        FLOAT_VEC vec = {};
+        for (size_t i = 0; i < field.length; i++) {
+            vec.push_back((float) (rng() % 1000) / 10);
+        }
+        return vec;
+    } else if (type == "string[]") {
+        STRING_VEC vec = {};
+        for (size_t i = 0; i < field.length; i++) {
+            vec.push_back(random_text(rng, 8));
+        }
+        return vec;
+    }
+    check(false, "No generator for type " + type);
+    return {};
+}
+
+struct CORPUS_SCHEMA {
+    string schema_name;
+    vector <FORMAT> format_lines;
+    vector <ATTRIBUTE_MAP> attributes;
+    vector <vector <uint8_t>> blobs;
+    size_t attribute_count;
+    size_t byte_count;
+};
+
+static CORPUS_SCHEMA build_schema(const SCHEMA_SPEC &spec, size_t blob_count, std::mt19937_64 &rng) {
+    CORPUS_SCHEMA schema = {};
+    schema.schema_name = spec.schema_name;
+    for (const FIELD_SPEC &field : spec.fields) {
+        schema.format_lines.push_back({field.name, field.type});
+    }
+    for (size_t i = 0; i < blob_count; i++) {
+        ATTRIBUTE_MAP attributes = {};
+        for (const FIELD_SPEC &field : spec.fields) {
+            attributes[field.name] = random_attribute(rng, field);
+        }
+        schema.blobs.push_back(serialize(attributes, schema.format_lines));
+        schema.attribute_count += attributes.size();
+        schema.byte_count += schema.blobs.back().size();
+        schema.attributes.push_back(std::move(attributes));
+    }
+    return schema;
+}
+
+struct MEASUREMENT {
+    double seconds;
+    size_t rounds;
+    size_t allocations;
+};
+
+// Runs round() until min_seconds have passed, after one warmup round
+template <typename ROUND>
+static MEASUREMENT measure(double min_seconds, ROUND &&round) {
+    round();
+
+    MEASUREMENT measurement = {};
+    size_t allocations_before = allocation_count;
+    auto start = std::chrono::steady_clock::now();
+    do {
+        round();
+        measurement.rounds++;
+        measurement.seconds = seconds_since(start);
+    } while (measurement.seconds < min_seconds);
+    measurement.allocations = allocation_count - allocations_before;
+    return measurement;
+}
+
+// An operation measured over every blob of a schema. run returns false if it does not apply to the schema
+struct VARIANT {
+    string name;
+    std::function <bool(const CORPUS_SCHEMA &, size_t)> run;
+};
+
+static void dump_schemas(const string &path) {
+    json rows = json::array();
+    for (const SCHEMA_SPEC &spec : CORPUS) {
+        json format = json::array();
+        for (const FIELD_SPEC &field : spec.fields) {
+            format.push_back({{"name", field.name}, {"type", field.type}});
+        }
+        rows.push_back({{"collection_name", COLLECTION_NAME}, {"schema_name", spec.schema_name}, {"format", format}});
+    }
+    std::ofstream out(path, std::ios::trunc);
+    check(out.good(), "Cannot write " + path);
+    out << rows.dump(2) << std::endl;
+}
+
+int main(int argc, char **argv) {
+    size_t blob_count = 1000;
+    double min_seconds = 0.2;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string option = argv[i];
+        if (option == "--blobs") {
+            blob_count = std::max(1ul, std::stoul(argv[i + 1]));
+        } else if (option == "--min-time") {
+            min_seconds = std::stod(argv[i + 1]);
+        } else if (option == "--dump-schemas") {
+            try {
+                dump_schemas(argv[i + 1]);
+            } catch (const std::exception &e) {
+                std::cerr << e.what() << std::endl;
+                return 1;
+            }
+            return 0;
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--blobs N] [--min-time SECONDS] [--dump-schemas schemas.json]"
+                << std::endl;
+            return 1;
+        }
+    }
+
+    std::mt19937_64 rng(42);
+    vector <CORPUS_SCHEMA> corpus = {};
+    for (const SCHEMA_SPEC &spec : CORPUS) {
+        corpus.push_back(build_schema(spec, blob_count, rng));
+    }
+
+    const vector <uint8_t> empty_data = {};
+    uint64_t collection_name = name_value(COLLECTION_NAME);
+
+    const vector <VARIANT> VARIANTS = {
+        {"serialize", [](const CORPUS_SCHEMA &schema, size_t i) {
+            sink += serialize(schema.attributes[i], schema.format_lines).size();
+            return true;
+        }},
+        {"deserialize", [](const CORPUS_SCHEMA &schema, size_t i) {
+            sink += deserialize(schema.blobs[i], schema.format_lines).size();
+            return true;
+        }},
+        {"generated decode", [&](const CORPUS_SCHEMA &schema, size_t i) {
+            return valuation::with_generated_attributes(
+                collection_name,
+                name_value(schema.schema_name),
+                schema.format_lines.size(),
+                nullptr,
+                schema.blobs[i],
+                empty_data,
+                [](const auto &attributes) {
+                    sink += attributes.has("name");
+                }
+            );
+        }}
+    };
+
+    std::cout << std::left << std::setw(12) << "schema" << std::setw(20) << "operation" << std::right
+        << std::setw(12) << "attrs/blob" << std::setw(12) << "bytes/blob" << std::setw(12) << "ns/attr"
+        << std::setw(14) << "allocs/blob" << std::endl;
+    std::cout << std::fixed;
+
+    for (const CORPUS_SCHEMA &schema : corpus) {
+        for (const VARIANT &variant : VARIANTS) {
+            if (!variant.run(schema, 0)) {
+                continue;
+            }
+            MEASUREMENT measurement = measure(min_seconds, [&]() {
+                for (size_t i = 0; i < schema.blobs.size(); i++) {
+                    variant.run(schema, i);
+                }
+            });
+            double attributes = (double) schema.attribute_count * measurement.rounds;
+            double blobs = (double) schema.blobs.size() * measurement.rounds;
+            std::cout << std::left << std::setw(12) << schema.schema_name << std::setw(20) << variant.name
+                << std::right << std::setprecision(1)
+                << std::setw(12) << (double) schema.attribute_count / schema.blobs.size()
+                << std::setw(12) << (double) schema.byte_count / schema.blobs.size()
+                << std::setw(12) << measurement.seconds * 1e9 / attributes
+                << std::setw(14) << measurement.allocations / blobs << std::endl;
+        }
+    }
+
+    vector <string> ipfs_strings = {};
+    vector <vector <uint8_t>> ipfs_bytes = {};
+    for (size_t i = 0; i < blob_count; i++) {
+        ipfs_strings.push_back(random_ipfs(rng));
+        ipfs_bytes.emplace_back();
+        DecodeBase58(ipfs_strings.back(), ipfs_bytes.back());
+    }
+
+    auto print_call = [&](const string &name, const MEASUREMENT &measurement) {
+        double calls = (double) blob_count * measurement.rounds;
+        std::cout << std::left << std::setw(32) << name << std::right << std::setprecision(1)
+            << std::setw(12) << measurement.seconds * 1e9 / calls << " ns/call"
+            << std::setw(10) << measurement.allocations / calls << " allocs/call" << std::endl;
+    };
+
+    std::cout << std::endl;
+    print_call("EncodeBase58 (34 byte hash)", measure(min_seconds, [&]() {
+        for (const vector <uint8_t> &bytes : ipfs_bytes) {
+            sink += EncodeBase58(bytes).size();
+        }
+    }));
+    print_call("DecodeBase58 (46 char hash)", measure(min_seconds, [&]() {
+        vector <uint8_t> result = {};
+        for (const string &text : ipfs_strings) {
+            result.clear();
+            sink += DecodeBase58(text, result);
+        }
+    }));
+
+    return 0;
+}
@@ -0,0 +1,276 @@
+#pragma once
+
+// Helpers shared by the native tools: loading exported atomicassets tables and token settings,
+// and a small parallel loop. Built against include/native so atomicdata.hpp compiles without the CDT.
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+#include "valuation.hpp"
+#include "nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+namespace tools {
+
+    struct VALUEFACTOR {
+        string value;
+        float factor;
+    };
+
+    // TRAITFACTOR without the token_share asset, which the valuation does not use
+    struct TRAITFACTOR {
+        string trait_name;
+        float min_value;
+        float max_value;
+        float min_factor;
+        float max_factor;
+        float avg_factor;
+        vector <VALUEFACTOR> values;
+    };
+
+    struct TOKEN {
+        int64_t maximum_supply;
+        uint8_t precision;
+        string symbol;
+        string schema_name;
+        uint32_t max_assets_to_tokenize;
+        vector <TRAITFACTOR> trait_factors;
+        vector <string> rarity_traits;
+    };
+
+    struct TEMPLATE {
+        string schema_name;
+        vector <uint8_t> immutable_serialized_data;
+    };
+
+    struct ASSET {
+        uint64_t asset_id;
+        string schema_name;
+        int32_t template_id;
+        vector <uint8_t> immutable_serialized_data;
+        vector <uint8_t> mutable_serialized_data;
+    };
+
+    struct COLLECTION {
+        string collection_name;
+        std::unordered_map <string, vector <FORMAT>> schemas;
+        std::unordered_map <int32_t, TEMPLATE> templates;
+        vector <ASSET> assets;
+    };
+
+    inline json read_json(const string &path) {
+        std::ifstream file(path);
+        check(file.good(), "Cannot open " + path);
+        return json::parse(file);
+    }
+
+    //get_table_rows returns uint8[] as an array of numbers, bytes as a hex string. Both are accepted.
+    inline vector <uint8_t> read_bytes(const json &value) {
+        vector <uint8_t> bytes = {};
+        if (value.is_string()) {
+            const string &hex = value.get_ref <const string &>();
+            check(hex.size() % 2 == 0, "Hex string has odd length");
+            bytes.reserve(hex.size() / 2);
+            for (size_t i = 0; i < hex.size(); i += 2) {
+                bytes.push_back((uint8_t) std::stoul(hex.substr(i, 2), nullptr, 16));
+            }
+        } else if (value.is_array()) {
+            bytes.reserve(value.size());
+            for (const json &byte : value) {
+                bytes.push_back(byte.get <uint8_t>());
+            }
+        }
+        return bytes;
+    }
+
+    inline int64_t read_int(const json &value) {
+        if (value.is_string()) {
+            return std::stoll(value.get <string>());
+        }
+        return value.get <int64_t>();
+    }
+
+    //Parses "1000.0000 ABC" into its amount, precision and symbol
+    inline void read_asset(const string &text, int64_t &amount, uint8_t &precision, string &symbol) {
+        size_t space = text.find(' ');
+        check(space != string::npos, "Invalid asset: " + text);
+
+        string number = text.substr(0, space);
+        symbol = text.substr(space + 1);
+
+        size_t dot = number.find('.');
+        precision = dot == string::npos ? 0 : number.size() - dot - 1;
+        if (dot != string::npos) {
+            number.erase(dot, 1);
+        }
+        amount = std::stoll(number);
+    }
+
+    // Value of an eosio name, as used by name::value
+    inline uint64_t name_value(const string &text) {
+        check(text.size() <= 13, "Invalid name: " + text);
+
+        auto char_value = [&](char c) -> uint64_t {
+            if (c >= 'a' && c <= 'z') {
+                return (c - 'a') + 6;
+            }
+            if (c >= '1' && c <= '5') {
+                return (c - '1') + 1;
+            }
+            check(c == '.', "Invalid name: " + text);
+            return 0;
+        };
+
+        uint64_t value = 0;
+        for (size_t i = 0; i < text.size(); i++) {
+            uint64_t c = char_value(text[i]);
+            if (i < 12) {
+                value |= (c & 0x1f) << (64 - 5 * (i + 1));
+            } else {
+                check(c <= 0x0f, "Invalid name: " + text);
+                value |= c & 0x0f;
+            }
+        }
+        return value;
+    }
+
+    inline vector <TRAITFACTOR> read_trait_factors(const json &factors) {
+        vector <TRAITFACTOR> trait_factors = {};
+        for (const json &factor : factors) {
+            TRAITFACTOR trait_factor = {};
+            trait_factor.trait_name = factor.at("trait_name").get <string>();
+            trait_factor.min_value = factor.value("min_value", 0.0f);
+            trait_factor.max_value = factor.value("max_value", 0.0f);
+            trait_factor.min_factor = factor.at("min_factor").get <float>();
+            trait_factor.max_factor = factor.at("max_factor").get <float>();
+            trait_factor.avg_factor = factor.at("avg_factor").get <float>();
+            if (factor.contains("values")) {
+                for (const json &value : factor.at("values")) {
+                    trait_factor.values.push_back({value.at("value").get <string>(), value.at("factor").get <float>()});
+                }
+            }
+            trait_factors.push_back(trait_factor);
+        }
+        return trait_factors;
+    }
+
+    // Token settings as passed to createtoken / setfactors:
+    // {"maximum_supply": "1000.0000 ABC", "schema_name": "...", "max_assets_to_tokenize": 100,
+    //  "trait_factors": [...], "rarity_traits": [...]}
+    inline TOKEN read_token(const json &data) {
+        TOKEN token = {};
+        read_asset(data.at("maximum_supply").get <string>(), token.maximum_supply, token.precision, token.symbol);
+        token.schema_name = data.at("schema_name").get <string>();
+        token.max_assets_to_tokenize = data.at("max_assets_to_tokenize").get <uint32_t>();
+        check(token.max_assets_to_tokenize > 0, "max_assets_to_tokenize must be > 0");
+        token.trait_factors = read_trait_factors(data.value("trait_factors", json::array()));
+        token.rarity_traits = data.value("rarity_traits", vector <string>{});
+        return token;
+    }
+
+    // Rows of the atomicassets schemas, templates and assets tables of one collection, as returned by
+    // get_table_rows: {"collection_name": "...", "schemas": [...], "templates": [...], "assets": [...]}
+    inline COLLECTION read_collection(const json &data) {
+        COLLECTION collection = {};
+        collection.collection_name = data.value("collection_name", "");
+
+        for (const json &schema : data.at("schemas")) {
+            vector <FORMAT> format_lines = {};
+            for (const json &line : schema.at("format")) {
+                format_lines.push_back({line.at("name").get <string>(), line.at("type").get <string>()});
+            }
+            collection.schemas[schema.at("schema_name").get <string>()] = format_lines;
+        }
+
+        for (const json &row : data.value("templates", json::array())) {
+            TEMPLATE template_row = {};
+            template_row.schema_name = row.at("schema_name").get <string>();
+            template_row.immutable_serialized_data = read_bytes(row.at("immutable_serialized_data"));
+            collection.templates[(int32_t) read_int(row.at("template_id"))] = template_row;
+        }
+
+        const json &assets = data.at("assets");
+        collection.assets.reserve(assets.size());
+        for (const json &row : assets) {
+            ASSET asset_row = {};
+            asset_row.asset_id = (uint64_t) read_int(row.at("asset_id"));
+            asset_row.schema_name = row.at("schema_name").get <string>();
+            asset_row.template_id = (int32_t) read_int(row.at("template_id"));
+            asset_row.immutable_serialized_data = read_bytes(row.at("immutable_serialized_data"));
+            asset_row.mutable_serialized_data = read_bytes(row.at("mutable_serialized_data"));
+            collection.assets.push_back(std::move(asset_row));
+        }
+
+        return collection;
+    }
+
+    //Deserialized template data of every template of the schema, decoded once up front
+    inline std::unordered_map <int32_t, ATTRIBUTE_MAP> decode_templates(
+        const COLLECTION &collection,
+        const string &schema_name,
+        const vector <FORMAT> &format_lines
+    ) {
+        std::unordered_map <int32_t, ATTRIBUTE_MAP> template_data = {};
+        for (const auto &[template_id, template_row] : collection.templates) {
+            if (template_row.schema_name == schema_name) {
+                template_data[template_id] = deserialize(template_row.immutable_serialized_data, format_lines);
+            }
+        }
+        return template_data;
+    }
+
+    inline string format_amount(int64_t amount, uint8_t precision) {
+        string sign = amount < 0 ? "-" : "";
+        uint64_t value = amount < 0 ? -(uint64_t) amount : amount;
+        string digits = std::to_string(value);
+        if (precision == 0) {
+            return sign + digits;
+        }
+        if (digits.size() <= precision) {
+            digits.insert(0, precision + 1 - digits.size(), '0');
+        }
+        return sign + digits.substr(0, digits.size() - precision) + "." + digits.substr(digits.size() - precision);
+    }
+
+    // Runs body(begin, end, thread_index) over [0, count) in chunks pulled by thread_count threads
+    template <typename BODY>
+    void parallel_for(size_t count, unsigned thread_count, BODY &&body) {
+        const size_t chunk_size = 1024;
+        std::atomic <size_t> next_chunk = 0;
+
+        auto worker = [&](unsigned thread_index) {
+            for (;;) {
+                size_t begin = next_chunk.fetch_add(chunk_size);
+                if (begin >= count) {
+                    return;
+                }
+                body(begin, std::min(count, begin + chunk_size), thread_index);
+            }
+        };
+
+        vector <std::thread> threads = {};
+        for (unsigned i = 1; i < thread_count; i++) {
+            threads.emplace_back(worker, i);
+        }
+        worker(0);
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+    }
+
+    inline unsigned default_thread_count() {
+        unsigned thread_count = std::thread::hardware_concurrency();
+        return thread_count > 0 ? thread_count : 1;
+    }
+
+    inline double seconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration <double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
@@ -0,0 +1,551 @@
+// Re-values a collection after the trait factors change, without decoding any asset again.
+//
+// usage: rwax-revalue init <collection.json> <token.json> <cache> [--threads N]
+//        rwax-revalue update <cache> <token.json> [--threads N] [--movers N] [--dry-run]
+//
+// init decodes every asset once and keeps the traits in a columnar cache, together with the factor
+// of every trait factor per asset. update diffs the trait factors against the ones in the cache and
+// only recomputes the factor columns of traits that changed. Issued amounts are then multiplied
+// together from the columns in trait factor order, so they match calculate_issued_tokens exactly.
+
+#include "common.hpp"
+
+using namespace tools;
+
+static constexpr char CACHE_MAGIC[8] = {'R', 'W', 'A', 'X', 'R', 'V', '0', '1'};
+
+static constexpr uint8_t TRAIT_MISSING = 0;
+static constexpr uint8_t TRAIT_STRING = 1;
+static constexpr uint8_t TRAIT_OTHER = 2;
+
+struct TRAIT_COLUMN {
+    string trait_name;
+    vector <string> dictionary;
+    vector <uint8_t> tags;
+    vector <uint32_t> strings;
+    vector <double> numbers;
+};
+
+struct FACTOR_COLUMN {
+    vector <float> factors;
+    vector <uint8_t> failed;
+};
+
+struct CACHE {
+    json token_data;
+    vector <uint64_t> asset_ids;
+    vector <uint8_t> decode_failed;
+    vector <TRAIT_COLUMN> traits;
+    vector <FACTOR_COLUMN> factors;
+    vector <int64_t> amounts;
+};
+
+// The trait of one asset as seen by valuation::get_trait_factor
+struct COLUMN_ATTRIBUTES {
+    const TRAIT_COLUMN &column;
+    size_t index;
+
+    bool has(const string &) const {
+        return column.tags[index] != TRAIT_MISSING;
+    }
+
+    const string &get_string(const string &trait_name) const {
+        check(column.tags[index] == TRAIT_STRING, "Trait is not a string: " + trait_name);
+        return column.dictionary[column.strings[index]];
+    }
+
+    double get_number(const string &) const {
+        return column.numbers[index];
+    }
+};
+
+struct STRING_ATTRIBUTE {
+    const string &value;
+
+    bool has(const string &) const {
+        return true;
+    }
+
+    const string &get_string(const string &) const {
+        return value;
+    }
+
+    double get_number(const string &) const {
+        return 0;
+    }
+};
+
+template <typename T>
+static void write_value(std::ostream &out, const T &value) {
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+static void write_vector(std::ostream &out, const vector <T> &values) {
+    write_value(out, (uint64_t) values.size());
+    out.write(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(T));
+}
+
+static void write_string(std::ostream &out, const string &value) {
+    write_value(out, (uint64_t) value.size());
+    out.write(value.data(), value.size());
+}
+
+template <typename T>
+static T read_value(std::istream &in) {
+    T value;
+    in.read(reinterpret_cast<char *>(&value), sizeof(T));
+    check(in.good(), "Cache is truncated");
+    return value;
+}
+
+template <typename T>
+static vector <T> read_vector(std::istream &in) {
+    vector <T> values(read_value <uint64_t>(in));
+    in.read(reinterpret_cast<char *>(values.data()), values.size() * sizeof(T));
+    check(in.good(), "Cache is truncated");
+    return values;
+}
+
+static string read_string(std::istream &in) {
+    string value(read_value <uint64_t>(in), '\0');
+    in.read(value.data(), value.size());
+    check(in.good(), "Cache is truncated");
+    return value;
+}
+
+static void save_cache(const string &path, const CACHE &cache) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    check(out.good(), "Cannot write " + path);
+
+    out.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    write_string(out, cache.token_data.dump());
+    write_vector(out, cache.asset_ids);
+    write_vector(out, cache.decode_failed);
+
+    write_value(out, (uint64_t) cache.traits.size());
+    for (const TRAIT_COLUMN &column : cache.traits) {
+        write_string(out, column.trait_name);
+        write_value(out, (uint64_t) column.dictionary.size());
+        for (const string &value : column.dictionary) {
+            write_string(out, value);
+        }
+        write_vector(out, column.tags);
+        write_vector(out, column.strings);
+        write_vector(out, column.numbers);
+    }
+
+    write_value(out, (uint64_t) cache.factors.size());
+    for (const FACTOR_COLUMN &column : cache.factors) {
+        write_vector(out, column.factors);
+        write_vector(out, column.failed);
+    }
+
+    write_vector(out, cache.amounts);
+}
+
+static CACHE load_cache(const string &path) {
+    std::ifstream in(path, std::ios::binary);
+    check(in.good(), "Cannot open " + path);
+
+    char magic[sizeof(CACHE_MAGIC)];
+    in.read(magic, sizeof(magic));
+    check(in.good() && std::equal(magic, magic + sizeof(magic), CACHE_MAGIC), "Not a rwax-revalue cache: " + path);
+
+    CACHE cache = {};
+    cache.token_data = json::parse(read_string(in));
+    cache.asset_ids = read_vector <uint64_t>(in);
+    cache.decode_failed = read_vector <uint8_t>(in);
+
+    cache.traits.resize(read_value <uint64_t>(in));
+    for (TRAIT_COLUMN &column : cache.traits) {
+        column.trait_name = read_string(in);
+        column.dictionary.resize(read_value <uint64_t>(in));
+        for (string &value : column.dictionary) {
+            value = read_string(in);
+        }
+        column.tags = read_vector <uint8_t>(in);
+        column.strings = read_vector <uint32_t>(in);
+        column.numbers = read_vector <double>(in);
+    }
+
+    cache.factors.resize(read_value <uint64_t>(in));
+    for (FACTOR_COLUMN &column : cache.factors) {
+        column.factors = read_vector <float>(in);
+        column.failed = read_vector <uint8_t>(in);
+    }
+
+    cache.amounts = read_vector <int64_t>(in);
+    return cache;
+}
+
+static bool is_rarity_trait(const TOKEN &token, const string &trait_name) {
+    return std::find(token.rarity_traits.begin(), token.rarity_traits.end(), trait_name) != token.rarity_traits.end();
+}
+
+static bool same_factor(const TRAITFACTOR &a, const TRAITFACTOR &b) {
+    if (a.trait_name != b.trait_name || a.min_value != b.min_value || a.max_value != b.max_value
+        || a.min_factor != b.min_factor || a.max_factor != b.max_factor || a.avg_factor != b.avg_factor
+        || a.values.size() != b.values.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.values.size(); i++) {
+        if (a.values[i].value != b.values[i].value || a.values[i].factor != b.values[i].factor) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Factor of one trait factor for every asset. String traits are valued once per distinct value.
+static FACTOR_COLUMN compute_factor_column(
+    const CACHE &cache,
+    const TRAITFACTOR &trait_factor,
+    bool is_rarity,
+    unsigned thread_count
+) {
+    size_t asset_count = cache.asset_ids.size();
+    FACTOR_COLUMN result = {vector <float>(asset_count, 1.0f), vector <uint8_t>(asset_count, 0)};
+
+    auto column_itr = std::find_if(cache.traits.begin(), cache.traits.end(), [&](const TRAIT_COLUMN &column) {
+        return column.trait_name == trait_factor.trait_name;
+    });
+    if (column_itr == cache.traits.end()) {
+        return result;
+    }
+    const TRAIT_COLUMN &column = *column_itr;
+
+    if (is_rarity || trait_factor.values.size() > 0) {
+        vector <uint32_t> value_counts(column.dictionary.size(), 0);
+        uint32_t total_count = 0;
+        if (is_rarity) {
+            for (size_t i = 0; i < asset_count; i++) {
+                if (column.tags[i] == TRAIT_STRING) {
+                    value_counts[column.strings[i]]++;
+                    total_count++;
+                }
+            }
+        }
+
+        vector <float> dictionary_factors(column.dictionary.size());
+        for (size_t value = 0; value < column.dictionary.size(); value++) {
+            dictionary_factors[value] = valuation::get_trait_factor(
+                trait_factor,
+                is_rarity,
+                STRING_ATTRIBUTE{column.dictionary[value]},
+                [&](const TRAITFACTOR &factor, const string &) {
+                    return valuation::get_rarity_factor(factor.min_factor, factor.max_factor, value_counts[value] - 1, total_count - 1);
+                }
+            );
+        }
+
+        parallel_for(asset_count, thread_count, [&](size_t begin, size_t end, unsigned) {
+            for (size_t i = begin; i < end; i++) {
+                if (column.tags[i] == TRAIT_STRING) {
+                    result.factors[i] = dictionary_factors[column.strings[i]];
+                } else if (column.tags[i] == TRAIT_OTHER) {
+                    result.failed[i] = 1;
+                }
+            }
+        });
+    } else {
+        parallel_for(asset_count, thread_count, [&](size_t begin, size_t end, unsigned) {
+            auto no_rarity = [](const TRAITFACTOR &, const string &) { return 1.0f; };
+            for (size_t i = begin; i < end; i++) {
+                result.factors[i] = valuation::get_trait_factor(trait_factor, false, COLUMN_ATTRIBUTES{column, i}, no_rarity);
+            }
+        });
+    }
+
+    return result;
+}
+
+static void compute_amounts(CACHE &cache, const TOKEN &token, unsigned thread_count) {
+    cache.amounts.assign(cache.asset_ids.size(), 0);
+
+    parallel_for(cache.asset_ids.size(), thread_count, [&](size_t begin, size_t end, unsigned) {
+        for (size_t i = begin; i < end; i++) {
+            valuation::FACTOR_PRODUCT product = {};
+            bool failed = cache.decode_failed[i];
+            for (size_t f = 0; f < token.trait_factors.size(); f++) {
+                failed = failed || cache.factors[f].failed[i];
+                product.add(cache.factors[f].factors[i], token.trait_factors[f].avg_factor);
+            }
+            cache.amounts[i] = failed
+                ? -1
+                : valuation::get_issued_amount(token.maximum_supply, token.max_assets_to_tokenize, product.ratio());
+        }
+    });
+}
+
+static CACHE build_cache(const COLLECTION &collection, const json &token_data, const TOKEN &token, unsigned thread_count) {
+    auto schema_itr = collection.schemas.find(token.schema_name);
+    check(schema_itr != collection.schemas.end(), "Schema " + token.schema_name + " not found in collection");
+    const vector <FORMAT> &format_lines = schema_itr->second;
+
+    std::unordered_map <int32_t, ATTRIBUTE_MAP> template_data = decode_templates(collection, token.schema_name, format_lines);
+
+    vector <const ASSET *> assets = {};
+    for (const ASSET &asset_row : collection.assets) {
+        if (asset_row.schema_name == token.schema_name && asset_row.template_id > 0) {
+            assets.push_back(&asset_row);
+        }
+    }
+
+    CACHE cache = {};
+    cache.token_data = token_data;
+    cache.asset_ids.reserve(assets.size());
+    cache.decode_failed.assign(assets.size(), 0);
+    for (const ASSET *asset_row : assets) {
+        cache.asset_ids.push_back(asset_row->asset_id);
+    }
+
+    for (const FORMAT &line : format_lines) {
+        TRAIT_COLUMN column = {};
+        column.trait_name = line.name;
+        column.tags.assign(assets.size(), TRAIT_MISSING);
+        column.strings.assign(assets.size(), 0);
+        column.numbers.assign(assets.size(), 0);
+        cache.traits.push_back(std::move(column));
+    }
+
+    // Every thread builds its own dictionaries, they are merged once all assets are decoded
+    using DICTIONARY = std::unordered_map <string, uint32_t>;
+    vector <vector <DICTIONARY>> thread_dictionaries(thread_count, vector <DICTIONARY>(format_lines.size()));
+    vector <uint16_t> asset_threads(assets.size(), 0);
+    const ATTRIBUTE_MAP empty_data = {};
+
+    parallel_for(assets.size(), thread_count, [&](size_t begin, size_t end, unsigned thread_index) {
+        vector <DICTIONARY> &dictionaries = thread_dictionaries[thread_index];
+        for (size_t i = begin; i < end; i++) {
+            asset_threads[i] = thread_index;
+            try {
+                auto template_itr = template_data.find(assets[i]->template_id);
+                ATTRIBUTE_MAP immutable_data = deserialize(assets[i]->immutable_serialized_data, format_lines);
+                ATTRIBUTE_MAP mutable_data = deserialize(assets[i]->mutable_serialized_data, format_lines);
+                valuation::ASSET_ATTRIBUTES attributes = {
+                    format_lines,
+                    template_itr != template_data.end() ? template_itr->second : empty_data,
+                    immutable_data,
+                    mutable_data
+                };
+
+                for (size_t c = 0; c < format_lines.size(); c++) {
+                    TRAIT_COLUMN &column = cache.traits[c];
+                    const ATOMIC_ATTRIBUTE *trait = attributes.find(column.trait_name);
+                    if (trait == nullptr) {
+                        continue;
+                    }
+                    column.numbers[i] = attributes.get_number(column.trait_name);
+                    if (std::holds_alternative <string>(*trait)) {
+                        auto entry = dictionaries[c].emplace(std::get <string>(*trait), dictionaries[c].size()).first;
+                        column.tags[i] = TRAIT_STRING;
+                        column.strings[i] = entry->second;
+                    } else {
+                        column.tags[i] = TRAIT_OTHER;
+                    }
+                }
+            } catch (const std::exception &) {
+                cache.decode_failed[i] = 1;
+            }
+        }
+    });
+
+    for (size_t c = 0; c < format_lines.size(); c++) {
+        TRAIT_COLUMN &column = cache.traits[c];
+        DICTIONARY merged = {};
+        vector <vector <uint32_t>> remaps(thread_count);
+        for (unsigned t = 0; t < thread_count; t++) {
+            const DICTIONARY &dictionary = thread_dictionaries[t][c];
+            remaps[t].resize(dictionary.size());
+            for (const auto &[value, local_index] : dictionary) {
+                auto entry = merged.emplace(value, merged.size()).first;
+                remaps[t][local_index] = entry->second;
+            }
+        }
+        column.dictionary.resize(merged.size());
+        for (const auto &[value, index] : merged) {
+            column.dictionary[index] = value;
+        }
+        for (size_t i = 0; i < assets.size(); i++) {
+            if (column.tags[i] == TRAIT_STRING) {
+                column.strings[i] = remaps[asset_threads[i]][column.strings[i]];
+            }
+        }
+    }
+
+    for (const TRAITFACTOR &trait_factor : token.trait_factors) {
+        cache.factors.push_back(compute_factor_column(cache, trait_factor, is_rarity_trait(token, trait_factor.trait_name), thread_count));
+    }
+    compute_amounts(cache, token, thread_count);
+
+    return cache;
+}
+
+static void print_summary(const CACHE &cache, const TOKEN &token) {
+    __int128 total = 0;
+    size_t failed = 0;
+    for (int64_t amount : cache.amounts) {
+        if (amount < 0) {
+            failed++;
+        } else {
+            total += amount;
+        }
+    }
+    std::cout << "Assets:            " << cache.asset_ids.size() << " (failed: " << failed << ")" << std::endl;
+    std::cout << "Issued supply:     " << format_amount((int64_t) total, token.precision) << " " << token.symbol
+        << " of " << format_amount(token.maximum_supply, token.precision) << " " << token.symbol << std::endl;
+}
+
+static int init(const string &collection_path, const string &token_path, const string &cache_path, unsigned thread_count) {
+    auto start = std::chrono::steady_clock::now();
+
+    json token_data = read_json(token_path);
+    TOKEN token = read_token(token_data);
+    CACHE cache = build_cache(read_collection(read_json(collection_path)), token_data, token, thread_count);
+    save_cache(cache_path, cache);
+
+    print_summary(cache, token);
+    std::cout << std::setprecision(3) << std::fixed << "Time:              " << seconds_since(start) << "s" << std::endl;
+    return 0;
+}
+
+static int update(const string &cache_path, const string &token_path, unsigned thread_count, size_t mover_count, bool dry_run) {
+    auto start = std::chrono::steady_clock::now();
+
+    CACHE cache = load_cache(cache_path);
+    TOKEN old_token = read_token(cache.token_data);
+    json token_data = read_json(token_path);
+    TOKEN new_token = read_token(token_data);
+
+    check(old_token.schema_name == new_token.schema_name, "Schema changed, run init again");
+
+    double load_seconds = seconds_since(start);
+    auto value_start = std::chrono::steady_clock::now();
+
+    // Trait factors are matched by trait name and occurrence, unchanged ones keep their column
+    vector <FACTOR_COLUMN> new_factors = {};
+    vector <bool> used(old_token.trait_factors.size(), false);
+    size_t reused = 0;
+    vector <string> recomputed = {};
+
+    for (const TRAITFACTOR &trait_factor : new_token.trait_factors) {
+        bool is_rarity = is_rarity_trait(new_token, trait_factor.trait_name);
+        bool found = false;
+        for (size_t f = 0; f < old_token.trait_factors.size() && !found; f++) {
+            if (!used[f] && old_token.trait_factors[f].trait_name == trait_factor.trait_name) {
+                used[f] = true;
+                found = true;
+                if (same_factor(old_token.trait_factors[f], trait_factor)
+                    && is_rarity_trait(old_token, trait_factor.trait_name) == is_rarity) {
+                    new_factors.push_back(std::move(cache.factors[f]));
+                    reused++;
+                } else {
+                    new_factors.push_back(compute_factor_column(cache, trait_factor, is_rarity, thread_count));
+                    recomputed.push_back(trait_factor.trait_name);
+                }
+            }
+        }
+        if (!found) {
+            new_factors.push_back(compute_factor_column(cache, trait_factor, is_rarity, thread_count));
+            recomputed.push_back(trait_factor.trait_name);
+        }
+    }
+
+    vector <int64_t> old_amounts = std::move(cache.amounts);
+    cache.factors = std::move(new_factors);
+    compute_amounts(cache, new_token, thread_count);
+
+    double value_seconds = seconds_since(value_start);
+
+    size_t changed = 0;
+    __int128 old_total = 0;
+    __int128 new_total = 0;
+    vector <size_t> movers = {};
+    for (size_t i = 0; i < cache.amounts.size(); i++) {
+        old_total += std::max <int64_t>(old_amounts[i], 0);
+        new_total += std::max <int64_t>(cache.amounts[i], 0);
+        if (cache.amounts[i] != old_amounts[i]) {
+            changed++;
+            movers.push_back(i);
+        }
+    }
+
+    auto delta = [&](size_t i) {
+        return std::abs((double) cache.amounts[i] - (double) old_amounts[i]);
+    };
+    size_t shown = std::min(mover_count, movers.size());
+    std::partial_sort(movers.begin(), movers.begin() + shown, movers.end(), [&](size_t a, size_t b) {
+        return delta(a) > delta(b);
+    });
+
+    auto amount = [&](int64_t value) {
+        return value < 0 ? string("failed") : format_amount(value, new_token.precision) + " " + new_token.symbol;
+    };
+
+    std::cout << "Trait factors:     " << reused << " unchanged, " << recomputed.size() << " recomputed";
+    for (const string &trait_name : recomputed) {
+        std::cout << " " << trait_name;
+    }
+    std::cout << std::endl;
+    std::cout << "Assets changed:    " << changed << " of " << cache.asset_ids.size() << std::endl;
+    std::cout << "Issued supply:     " << amount((int64_t) old_total) << " -> " << amount((int64_t) new_total)
+        << " of " << amount(new_token.maximum_supply) << std::endl;
+
+    if (shown > 0) {
+        std::cout << "Largest changes:" << std::endl;
+        for (size_t m = 0; m < shown; m++) {
+            size_t i = movers[m];
+            std::cout << "  " << std::setw(16) << cache.asset_ids[i] << "  " << amount(old_amounts[i])
+                << " -> " << amount(cache.amounts[i]) << std::endl;
+        }
+    }
+
+    if (!dry_run) {
+        cache.token_data = token_data;
+        save_cache(cache_path, cache);
+    }
+
+    std::cout << std::setprecision(3) << std::fixed << "Time:              load " << load_seconds
+        << "s, revaluation " << value_seconds << "s" << (dry_run ? " (dry run, cache unchanged)" : "") << std::endl;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    string command = argc > 1 ? argv[1] : "";
+    size_t positional = command == "init" ? 3 : 2;
+
+    if ((command != "init" && command != "update") || argc < 2 + (int) positional) {
+        std::cerr << "usage: " << argv[0] << " init <collection.json> <token.json> <cache> [--threads N]" << std::endl
+            << "       " << argv[0] << " update <cache> <token.json> [--threads N] [--movers N] [--dry-run]" << std::endl;
+        return 1;
+    }
+
+    unsigned thread_count = default_thread_count();
+    size_t mover_count = 10;
+    bool dry_run = false;
+
+    for (int i = 2 + positional; i < argc; i++) {
+        string option = argv[i];
+        if (option == "--dry-run") {
+            dry_run = true;
+        } else if (option == "--threads" && i + 1 < argc) {
+            thread_count = std::max(1, std::stoi(argv[++i]));
+        } else if (option == "--movers" && i + 1 < argc) {
+            mover_count = std::stoul(argv[++i]);
+        } else {
+            std::cerr << "Unknown option " << option << std::endl;
+            return 1;
+        }
+    }
+
+    try {
+        if (command == "init") {
+            return init(argv[2], argv[3], argv[4], thread_count);
+        }
+        return update(argv[2], argv[3], thread_count, mover_count, dry_run);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
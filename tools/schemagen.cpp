@@ -0,0 +1,350 @@
+// Generates typed decoders for atomicassets schemas.
+//
+// usage: rwax-schemagen [--out generated_schemas.hpp] <schema.json>...
+//
+// Every input is a schemas table row plus its collection, or an array of them:
+// {"collection_name": "...", "schema_name": "...", "format": [{"name": "...", "type": "..."}, ...]}
+//
+// For every schema the header contains a struct with one typed member per format line and a decode()
+// that reads serialized data with the field order and types fixed at compile time, instead of going
+// through atomicdata::deserialize and ATOMIC_ATTRIBUTE. The struct has the has / get_string / get_number
+// interface of valuation::ASSET_ATTRIBUTES, so valuation::get_factor_ratio can use it directly.
+// generated_schemas::with_attributes picks the decoder for a (collection, schema) pair.
+
+#include <set>
+
+#include "common.hpp"
+
+using namespace tools;
+
+struct FIELD {
+    string name;
+    string type;
+    string member;
+    string base_type;
+    bool is_array;
+};
+
+struct SCHEMA {
+    string collection_name;
+    string schema_name;
+    string struct_name;
+    vector <FIELD> fields;
+};
+
+static const std::set <string> CPP_KEYWORDS = {
+    "alignas", "alignof", "and", "asm", "auto", "bool", "break", "case", "catch", "char", "class", "const",
+    "constexpr", "continue", "default", "delete", "do", "double", "else", "enum", "explicit", "export", "extern",
+    "false", "float", "for", "friend", "goto", "if", "inline", "int", "long", "mutable", "namespace", "new",
+    "noexcept", "not", "nullptr", "operator", "or", "private", "protected", "public", "register", "return",
+    "short", "signed", "sizeof", "static", "struct", "switch", "template", "this", "throw", "true", "try",
+    "typedef", "typeid", "typename", "union", "unsigned", "using", "virtual", "void", "volatile", "while", "xor"
+};
+
+//Names used by the generated code itself, fields with these names get a trailing underscore
+static const std::set <string> RESERVED_MEMBERS = {
+    "COLLECTION_NAME", "SCHEMA_NAME", "FIELD_COUNT", "present", "decode", "field_index", "has", "get_string",
+    "get_number", "data", "itr", "identifier", "array_length", "i", "trait_name", "index"
+};
+
+static string identifier(const string &text) {
+    string result = {};
+    for (char c : text) {
+        result += std::isalnum((unsigned char) c) ? c : '_';
+    }
+    if (result.empty() || std::isdigit((unsigned char) result[0])) {
+        result = "_" + result;
+    }
+    if (CPP_KEYWORDS.count(result) > 0) {
+        result += "_";
+    }
+    return result;
+}
+
+static string cpp_type(const string &base_type) {
+    static const std::map <string, string> types = {
+        {"int8", "int8_t"}, {"int16", "int16_t"}, {"int32", "int32_t"}, {"int64", "int64_t"},
+        {"uint8", "uint8_t"}, {"uint16", "uint16_t"}, {"uint32", "uint32_t"}, {"uint64", "uint64_t"},
+        {"fixed8", "uint8_t"}, {"fixed16", "uint16_t"}, {"fixed32", "uint32_t"}, {"fixed64", "uint64_t"},
+        {"byte", "uint8_t"}, {"bool", "uint8_t"},
+        {"float", "float"}, {"double", "double"},
+        {"string", "std::string"}, {"image", "std::string"}, {"ipfs", "std::string"}
+    };
+    auto itr = types.find(base_type);
+    check(itr != types.end(), "No type could be matched - " + base_type);
+    return itr->second;
+}
+
+// Expression reading one value of base_type at itr, the same way atomicdata::deserialize_attribute does
+static string read_expression(const string &base_type) {
+    if (base_type == "int8" || base_type == "int16" || base_type == "int32" || base_type == "int64") {
+        return "(" + cpp_type(base_type) + ") zigzagDecode(unsignedFromVarintBytes(itr))";
+    }
+    if (base_type == "uint8" || base_type == "uint16" || base_type == "uint32" || base_type == "uint64") {
+        return "(" + cpp_type(base_type) + ") unsignedFromVarintBytes(itr)";
+    }
+    if (base_type == "fixed8" || base_type == "fixed16" || base_type == "fixed32" || base_type == "fixed64") {
+        return "(" + cpp_type(base_type) + ") unsignedFromIntBytes(itr, " + std::to_string(std::stoi(base_type.substr(5)) / 8) + ")";
+    }
+    if (base_type == "float") {
+        return "read_float <float>(itr)";
+    }
+    if (base_type == "double") {
+        return "read_float <double>(itr)";
+    }
+    if (base_type == "string" || base_type == "image") {
+        return "read_string(itr)";
+    }
+    if (base_type == "ipfs") {
+        return "read_ipfs(itr)";
+    }
+    if (base_type == "bool" || base_type == "byte") {
+        return "*itr++";
+    }
+    check(false, "No type could be matched - " + base_type);
+    return "";
+}
+
+static bool is_string_type(const FIELD &field) {
+    return !field.is_array && (field.type == "string" || field.type == "image" || field.type == "ipfs");
+}
+
+//Types valuation::ASSET_ATTRIBUTES::get_number reads, every other type counts as 0
+static bool is_number_type(const FIELD &field) {
+    static const std::set <string> number_types = {
+        "int8", "int16", "int32", "int64", "uint8", "uint16", "uint32", "uint64", "float", "double"
+    };
+    return number_types.count(field.type) > 0;
+}
+
+static SCHEMA read_schema(const json &data) {
+    SCHEMA schema = {};
+    schema.collection_name = data.at("collection_name").get <string>();
+    schema.schema_name = data.at("schema_name").get <string>();
+    schema.struct_name = identifier(schema.collection_name + "_" + schema.schema_name);
+
+    std::set <string> members = {};
+    for (const json &line : data.at("format")) {
+        FIELD field = {};
+        field.name = line.at("name").get <string>();
+        field.type = line.at("type").get <string>();
+        field.is_array = field.type.size() > 2 && field.type.compare(field.type.size() - 2, 2, "[]") == 0;
+        field.base_type = field.is_array ? field.type.substr(0, field.type.size() - 2) : field.type;
+        cpp_type(field.base_type);
+
+        field.member = identifier(field.name);
+        while (members.count(field.member) > 0 || RESERVED_MEMBERS.count(field.member) > 0) {
+            field.member += "_";
+        }
+        members.insert(field.member);
+        schema.fields.push_back(field);
+    }
+    return schema;
+}
+
+static string quoted(const string &text) {
+    return json(text).dump();
+}
+
+static void write_schema(std::ostream &out, const SCHEMA &schema) {
+    const vector <FIELD> &fields = schema.fields;
+
+    out << "    // " << schema.collection_name << " / " << schema.schema_name << "\n";
+    out << "    struct " << schema.struct_name << " {\n";
+    out << "        static constexpr uint64_t COLLECTION_NAME = " << name_value(schema.collection_name) << "ull;\n";
+    out << "        static constexpr uint64_t SCHEMA_NAME = " << name_value(schema.schema_name) << "ull;\n";
+    out << "        static constexpr size_t FIELD_COUNT = " << fields.size() << ";\n\n";
+
+    for (const FIELD &field : fields) {
+        string type = cpp_type(field.base_type);
+        out << "        " << (field.is_array ? "std::vector <" + type + ">" : type) << " " << field.member
+            << (field.is_array || type == "std::string" ? "" : " = 0") << ";\n";
+    }
+    out << "        std::bitset <" << std::max <size_t>(fields.size(), 1) << "> present;\n\n";
+
+    out << "        //Fields in data overwrite the ones decoded before. Decode template, immutable and mutable data in that order.\n";
+    out << "        void decode(const std::vector <uint8_t> &data) {\n";
+    out << "            auto itr = data.begin();\n";
+    out << "            while (itr != data.end()) {\n";
+    out << "                uint64_t identifier = unsignedFromVarintBytes(itr);\n";
+    out << "                switch (identifier) {\n";
+    for (size_t i = 0; i < fields.size(); i++) {
+        const FIELD &field = fields[i];
+        out << "                    case " << i + atomicdata::RESERVED << ":\n";
+        if (field.is_array) {
+            out << "                        {\n";
+            out << "                            uint64_t array_length = unsignedFromVarintBytes(itr);\n";
+            out << "                            " << field.member << ".clear();\n";
+            out << "                            " << field.member << ".reserve(array_length);\n";
+            out << "                            for (uint64_t i = 0; i < array_length; i++) {\n";
+            out << "                                " << field.member << ".push_back(" << read_expression(field.base_type) << ");\n";
+            out << "                            }\n";
+            out << "                        }\n";
+        } else {
+            out << "                        " << field.member << " = " << read_expression(field.base_type) << ";\n";
+        }
+        out << "                        present.set(" << i << ");\n";
+        out << "                        break;\n";
+    }
+    out << "                    default:\n";
+    out << "                        check(false, \"Unknown attribute identifier for " << schema.schema_name << "\");\n";
+    out << "                }\n";
+    out << "            }\n";
+    out << "        }\n\n";
+
+    out << "        static int field_index(const std::string &trait_name) {\n";
+    for (size_t i = 0; i < fields.size(); i++) {
+        out << "            if (trait_name == " << quoted(fields[i].name) << ") {\n";
+        out << "                return " << i << ";\n";
+        out << "            }\n";
+    }
+    out << "            return -1;\n";
+    out << "        }\n\n";
+
+    out << "        bool has(const std::string &trait_name) const {\n";
+    out << "            int index = field_index(trait_name);\n";
+    out << "            return index >= 0 && present.test(index);\n";
+    out << "        }\n\n";
+
+    out << "        std::string get_string(const std::string &trait_name) const {\n";
+    out << "            switch (field_index(trait_name)) {\n";
+    for (size_t i = 0; i < fields.size(); i++) {
+        if (is_string_type(fields[i])) {
+            out << "                case " << i << ":\n";
+            out << "                    return " << fields[i].member << ";\n";
+        }
+    }
+    out << "                default:\n";
+    out << "                    check(false, \"Trait is not a string: \" + trait_name);\n";
+    out << "                    return {};\n";
+    out << "            }\n";
+    out << "        }\n\n";
+
+    out << "        double get_number(const std::string &trait_name) const {\n";
+    out << "            switch (field_index(trait_name)) {\n";
+    for (size_t i = 0; i < fields.size(); i++) {
+        if (is_number_type(fields[i])) {
+            out << "                case " << i << ":\n";
+            out << "                    return " << fields[i].member << ";\n";
+        }
+    }
+    out << "                default:\n";
+    out << "                    return 0;\n";
+    out << "            }\n";
+    out << "        }\n";
+    out << "    };\n\n";
+}
+
+static void write_header(std::ostream &out, const vector <SCHEMA> &schemas) {
+    out << "#pragma once\n\n";
+    out << "// Generated by rwax-schemagen. Do not edit, run rwax-schemagen again when a schema changes.\n\n";
+    out << "#include <bitset>\n\n";
+    out << "#include \"atomicdata.hpp\"\n\n";
+    out << "namespace generated_schemas {\n\n";
+    out << "    using namespace atomicdata;\n\n";
+
+    out << "    template <typename T>\n";
+    out << "    T read_float(vector <uint8_t>::const_iterator &itr) {\n";
+    out << "        T value;\n";
+    out << "        memcpy(&value, &*itr, sizeof(T));\n";
+    out << "        itr += sizeof(T);\n";
+    out << "        return value;\n";
+    out << "    }\n\n";
+
+    out << "    inline std::string read_string(vector <uint8_t>::const_iterator &itr) {\n";
+    out << "        uint64_t string_length = unsignedFromVarintBytes(itr);\n";
+    out << "        std::string text(itr, itr + string_length);\n";
+    out << "        itr += string_length;\n";
+    out << "        return text;\n";
+    out << "    }\n\n";
+
+    out << "    inline std::string read_ipfs(vector <uint8_t>::const_iterator &itr) {\n";
+    out << "        uint64_t array_length = unsignedFromVarintBytes(itr);\n";
+    out << "        const unsigned char *begin = array_length > 0 ? &*itr : nullptr;\n";
+    out << "        std::string text = EncodeBase58(begin, begin + array_length);\n";
+    out << "        itr += array_length;\n";
+    out << "        return text;\n";
+    out << "    }\n\n";
+
+    for (const SCHEMA &schema : schemas) {
+        write_schema(out, schema);
+    }
+
+    out << "    // Decodes the data of an asset with the generated decoder of its schema and calls body(attributes).\n";
+    out << "    // Returns false if there is none, or if the schema has been extended since the decoder was generated.\n";
+    out << "    template <typename BODY>\n";
+    out << "    bool with_attributes(\n";
+    out << "        uint64_t collection_name,\n";
+    out << "        uint64_t schema_name,\n";
+    out << "        size_t format_size,\n";
+    out << "        const std::vector <uint8_t> *template_data,\n";
+    out << "        const std::vector <uint8_t> &immutable_data,\n";
+    out << "        const std::vector <uint8_t> &mutable_data,\n";
+    out << "        BODY &&body\n";
+    out << "    ) {\n";
+    for (const SCHEMA &schema : schemas) {
+        out << "        if (collection_name == " << schema.struct_name << "::COLLECTION_NAME && schema_name == "
+            << schema.struct_name << "::SCHEMA_NAME && format_size == " << schema.struct_name << "::FIELD_COUNT) {\n";
+        out << "            " << schema.struct_name << " attributes = {};\n";
+        out << "            if (template_data != nullptr) {\n";
+        out << "                attributes.decode(*template_data);\n";
+        out << "            }\n";
+        out << "            attributes.decode(immutable_data);\n";
+        out << "            attributes.decode(mutable_data);\n";
+        out << "            body(attributes);\n";
+        out << "            return true;\n";
+        out << "        }\n";
+    }
+    out << "        return false;\n";
+    out << "    }\n";
+    out << "}\n";
+}
+
+int main(int argc, char **argv) {
+    string out_path = {};
+    vector <string> inputs = {};
+
+    for (int i = 1; i < argc; i++) {
+        string argument = argv[i];
+        if (argument == "--out" && i + 1 < argc) {
+            out_path = argv[++i];
+        } else {
+            inputs.push_back(argument);
+        }
+    }
+
+    if (inputs.empty()) {
+        std::cerr << "usage: " << argv[0] << " [--out generated_schemas.hpp] <schema.json>..." << std::endl;
+        return 1;
+    }
+
+    try {
+        vector <SCHEMA> schemas = {};
+        std::set <string> struct_names = {};
+        for (const string &input : inputs) {
+            json data = read_json(input);
+            vector <json> rows = data.is_array() ? data.get <vector <json>>() : vector <json>{data};
+            for (const json &row : rows) {
+                SCHEMA schema = read_schema(row);
+                check(struct_names.insert(schema.struct_name).second, "Schema listed twice: " + schema.struct_name);
+                schemas.push_back(schema);
+            }
+        }
+
+        std::ostringstream header;
+        write_header(header, schemas);
+
+        if (out_path.empty()) {
+            std::cout << header.str();
+        } else {
+            std::ofstream out(out_path, std::ios::trunc);
+            check(out.good(), "Cannot write " + out_path);
+            out << header.str();
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
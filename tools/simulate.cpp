@@ -0,0 +1,300 @@
+// Values every asset of an exported collection with the same code calculate_issued_tokens uses on chain,
+// to see how much supply a set of trait factors would issue before calling createtoken or setfactors.
+//
+// usage: rwax-simulate <collection.json> <token.json> [--threads N] [--outliers N] [--buckets N]
+//
+// Rarity traits are valued as if every other asset of the schema was already pooled.
+// Configure with -DRWAX_SCHEMAS=<schema.json> to decode with a decoder generated by rwax-schemagen.
+
+#include "common.hpp"
+
+using namespace tools;
+
+struct RESULT {
+    uint64_t asset_id;
+    int64_t amount;
+};
+
+struct RARITY_COUNTS {
+    std::unordered_map <string, uint32_t> values;
+    std::unordered_map <string, uint32_t> totals;
+};
+
+static string rarity_key(const string &trait_name, const string &value) {
+    return trait_name + '\0' + value;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        std::cerr << "usage: " << argv[0]
+            << " <collection.json> <token.json> [--threads N] [--outliers N] [--buckets N]" << std::endl;
+        return 1;
+    }
+
+    unsigned thread_count = default_thread_count();
+    size_t outlier_count = 10;
+    size_t bucket_count = 10;
+
+    for (int i = 3; i + 1 < argc; i += 2) {
+        string option = argv[i];
+        if (option == "--threads") {
+            thread_count = std::max(1, std::stoi(argv[i + 1]));
+        } else if (option == "--outliers") {
+            outlier_count = std::stoul(argv[i + 1]);
+        } else if (option == "--buckets") {
+            bucket_count = std::max(1ul, std::stoul(argv[i + 1]));
+        } else {
+            std::cerr << "Unknown option " << option << std::endl;
+            return 1;
+        }
+    }
+
+    auto load_start = std::chrono::steady_clock::now();
+
+    COLLECTION collection;
+    TOKEN token;
+    try {
+        collection = read_collection(read_json(argv[1]));
+        token = read_token(read_json(argv[2]));
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    auto schema_itr = collection.schemas.find(token.schema_name);
+    if (schema_itr == collection.schemas.end()) {
+        std::cerr << "Schema " << token.schema_name << " not found in collection" << std::endl;
+        return 1;
+    }
+    const vector <FORMAT> &format_lines = schema_itr->second;
+
+    std::unordered_map <int32_t, ATTRIBUTE_MAP> template_data = decode_templates(collection, token.schema_name, format_lines);
+
+    vector <const ASSET *> assets = {};
+    size_t other_schema = 0;
+    size_t without_template = 0;
+    for (const ASSET &asset_row : collection.assets) {
+        if (asset_row.schema_name != token.schema_name) {
+            other_schema++;
+        } else if (asset_row.template_id <= 0) {
+            without_template++;
+        } else {
+            assets.push_back(&asset_row);
+        }
+    }
+
+    double load_seconds = seconds_since(load_start);
+    auto value_start = std::chrono::steady_clock::now();
+
+    const ATTRIBUTE_MAP empty_data = {};
+
+    uint64_t collection_name = collection.collection_name.empty() ? 0 : name_value(collection.collection_name);
+    uint64_t schema_name = name_value(token.schema_name);
+
+    // Decodes the asset and calls body(attributes), with the generated decoder of the schema if the build
+    // has one. Returns false and keeps the error if decoding fails.
+    auto with_attributes = [&](const ASSET &asset_row, string &error, auto &&body) {
+        try {
+            auto template_row_itr = collection.templates.find(asset_row.template_id);
+            bool decoded = valuation::with_generated_attributes(
+                collection_name,
+                schema_name,
+                format_lines.size(),
+                template_row_itr != collection.templates.end() ? &template_row_itr->second.immutable_serialized_data : nullptr,
+                asset_row.immutable_serialized_data,
+                asset_row.mutable_serialized_data,
+                body
+            );
+            if (decoded) {
+                return true;
+            }
+
+            auto template_itr = template_data.find(asset_row.template_id);
+            ATTRIBUTE_MAP immutable_data = deserialize(asset_row.immutable_serialized_data, format_lines);
+            ATTRIBUTE_MAP mutable_data = deserialize(asset_row.mutable_serialized_data, format_lines);
+            valuation::ASSET_ATTRIBUTES attributes = {
+                format_lines,
+                template_itr != template_data.end() ? template_itr->second : empty_data,
+                immutable_data,
+                mutable_data
+            };
+            body(attributes);
+            return true;
+        } catch (const std::exception &e) {
+            error = e.what();
+            return false;
+        }
+    };
+
+    RARITY_COUNTS rarity_counts = {};
+
+    if (token.rarity_traits.size() > 0) {
+        vector <RARITY_COUNTS> thread_counts(thread_count);
+
+        parallel_for(assets.size(), thread_count, [&](size_t begin, size_t end, unsigned thread_index) {
+            RARITY_COUNTS &counts = thread_counts[thread_index];
+            string error;
+            for (size_t i = begin; i < end; i++) {
+                with_attributes(*assets[i], error, [&](const auto &attributes) {
+                    for (const string &trait_name : token.rarity_traits) {
+                        if (attributes.has(trait_name)) {
+                            counts.values[rarity_key(trait_name, attributes.get_string(trait_name))]++;
+                            counts.totals[trait_name]++;
+                        }
+                    }
+                });
+            }
+        });
+
+        for (const RARITY_COUNTS &counts : thread_counts) {
+            for (const auto &[key, count] : counts.values) {
+                rarity_counts.values[key] += count;
+            }
+            for (const auto &[key, count] : counts.totals) {
+                rarity_counts.totals[key] += count;
+            }
+        }
+    }
+
+    auto get_rarity = [&](const TRAITFACTOR &trait_factor, const string &trait_value) {
+        auto value_itr = rarity_counts.values.find(rarity_key(trait_factor.trait_name, trait_value));
+        auto total_itr = rarity_counts.totals.find(trait_factor.trait_name);
+        uint32_t value_count = value_itr != rarity_counts.values.end() ? value_itr->second - 1 : 0;
+        uint32_t total_count = total_itr != rarity_counts.totals.end() ? total_itr->second - 1 : 0;
+        return valuation::get_rarity_factor(trait_factor.min_factor, trait_factor.max_factor, value_count, total_count);
+    };
+
+    vector <RESULT> results(assets.size());
+    vector <uint8_t> failed(assets.size(), 0);
+    vector <string> thread_errors(thread_count);
+
+    parallel_for(assets.size(), thread_count, [&](size_t begin, size_t end, unsigned thread_index) {
+        for (size_t i = begin; i < end; i++) {
+            float factor_ratio = 1.0;
+            if (token.trait_factors.size() > 0) {
+                bool decoded = with_attributes(*assets[i], thread_errors[thread_index], [&](const auto &attributes) {
+                    factor_ratio = valuation::get_factor_ratio(token.trait_factors, token.rarity_traits, attributes, get_rarity);
+                });
+                if (!decoded) {
+                    failed[i] = 1;
+                }
+            }
+            results[i] = {
+                assets[i]->asset_id,
+                valuation::get_issued_amount(token.maximum_supply, token.max_assets_to_tokenize, factor_ratio)
+            };
+        }
+    });
+
+    double value_seconds = seconds_since(value_start);
+
+    vector <RESULT> valued = {};
+    valued.reserve(results.size());
+    for (size_t i = 0; i < results.size(); i++) {
+        if (!failed[i]) {
+            valued.push_back(results[i]);
+        }
+    }
+    size_t failed_count = results.size() - valued.size();
+
+    auto amount = [&](int64_t value) {
+        return format_amount(value, token.precision) + " " + token.symbol;
+    };
+
+    std::cout << "Assets valued:     " << valued.size() << " (other schemas: " << other_schema
+        << ", no template: " << without_template << ", failed: " << failed_count << ")" << std::endl;
+    for (const string &error : thread_errors) {
+        if (!error.empty()) {
+            std::cout << "  last error:      " << error << std::endl;
+        }
+    }
+
+    if (valued.empty()) {
+        return 0;
+    }
+
+    std::sort(valued.begin(), valued.end(), [](const RESULT &a, const RESULT &b) {
+        return a.amount < b.amount || (a.amount == b.amount && a.asset_id < b.asset_id);
+    });
+
+    __int128 total = 0;
+    for (const RESULT &result : valued) {
+        total += result.amount;
+    }
+
+    std::cout << "Issued supply:     " << amount((int64_t) total) << " of " << amount(token.maximum_supply)
+        << " (" << std::fixed << std::setprecision(2) << 100.0 * (double) total / token.maximum_supply << "%)" << std::endl;
+
+    if (valued.size() > token.max_assets_to_tokenize) {
+        std::cout << "Asset cap:         " << valued.size() << " assets, but max_assets_to_tokenize is "
+            << token.max_assets_to_tokenize << std::endl;
+    }
+
+    if (total > token.maximum_supply) {
+        __int128 running = 0;
+        size_t fitting = 0;
+        while (fitting < valued.size() && running + valued[fitting].amount <= token.maximum_supply) {
+            running += valued[fitting].amount;
+            fitting++;
+        }
+        std::cout << "Supply exceeded:   at most " << fitting << " assets fit, cheapest first" << std::endl;
+    }
+
+    auto percentile = [&](double p) {
+        return valued[std::min(valued.size() - 1, (size_t) (p * (valued.size() - 1) + 0.5))].amount;
+    };
+
+    int64_t median = percentile(0.5);
+
+    std::cout << "Per asset:" << std::endl;
+    std::cout << "  min              " << amount(valued.front().amount) << std::endl;
+    std::cout << "  p10              " << amount(percentile(0.1)) << std::endl;
+    std::cout << "  median           " << amount(median) << std::endl;
+    std::cout << "  mean             " << amount((int64_t) (total / valued.size())) << std::endl;
+    std::cout << "  p90              " << amount(percentile(0.9)) << std::endl;
+    std::cout << "  max              " << amount(valued.back().amount) << std::endl;
+
+    int64_t low = valued.front().amount;
+    int64_t high = valued.back().amount;
+    if (high > low) {
+        vector <size_t> buckets(bucket_count, 0);
+        for (const RESULT &result : valued) {
+            size_t bucket = (size_t) ((double) (result.amount - low) / (double) (high - low) * bucket_count);
+            buckets[std::min(bucket, bucket_count - 1)]++;
+        }
+        size_t largest = *std::max_element(buckets.begin(), buckets.end());
+
+        std::cout << "Distribution:" << std::endl;
+        for (size_t i = 0; i < bucket_count; i++) {
+            int64_t bucket_low = low + (int64_t) ((double) (high - low) * i / bucket_count);
+            size_t width = largest > 0 ? buckets[i] * 40 / largest : 0;
+            std::cout << "  >= " << std::setw(24) << std::left << amount(bucket_low) << std::right
+                << std::setw(10) << buckets[i] << " " << string(width, '#') << std::endl;
+        }
+    }
+
+    auto print_outlier = [&](const RESULT &result) {
+        std::cout << "  " << std::setw(16) << result.asset_id << "  " << amount(result.amount);
+        if (median > 0) {
+            std::cout << "  (" << std::setprecision(2) << (double) result.amount / median << "x median)";
+        }
+        std::cout << std::endl;
+    };
+
+    size_t shown = std::min(outlier_count, valued.size());
+    if (shown > 0) {
+        std::cout << "Most valuable:" << std::endl;
+        for (size_t i = 0; i < shown; i++) {
+            print_outlier(valued[valued.size() - 1 - i]);
+        }
+        std::cout << "Least valuable:" << std::endl;
+        for (size_t i = 0; i < shown; i++) {
+            print_outlier(valued[i]);
+        }
+    }
+
+    std::cout << std::setprecision(3) << "Time:              load " << load_seconds << "s, valuation "
+        << value_seconds << "s on " << thread_count << " threads" << std::endl;
+
+    return 0;
+}